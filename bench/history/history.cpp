@@ -0,0 +1,122 @@
+/*
+ * Host benchmark of History: compression, retention, decode speed and range query time
+ * on 3 days of synthetic noisy readings (2 sec. period), in-memory file system.
+ * Build and run from repository root:
+ *   g++ -O2 -std=c++11 -Ibench/history/shim -Iinclude bench/history/history.cpp src/History.cpp src/Crc16.cpp -o history && ./history
+ */
+
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <vector>
+#include "History.h"
+
+FS LittleFS;
+
+static double elapsed(std::chrono::steady_clock::time_point start) { // In sec.
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static size_t fileSize(History::tier_t tier) { // Current and old file
+  char name[16];
+  size_t result;
+
+  History::path(name, tier);
+  result = LittleFS.size(name);
+  History::path(name, tier, true);
+  return result + LittleFS.size(name);
+}
+
+int main() {
+  const uint32_t START = 1700000000;
+  const uint32_t SAMPLES = 86400 / 2 * 3; // 3 days
+  const int QUERIES = 200;
+
+  History history;
+  std::map<uint32_t, History::point_t> source;
+  History::point_t point;
+  double temp = 2200, hum = 4500;
+  uint32_t time = START;
+  uint8_t buffer[1460];
+
+  srand(2);
+  for (uint32_t i = 0; i < SAMPLES; ++i) {
+    time += 2 + (rand() % 50 == 0); // Occasional jitter
+    temp += (rand() % 7 - 3) * 0.3 + 0.5 * sin(i / 5000.0);
+    hum += (rand() % 7 - 3) * 0.5;
+    point = { time, (int16_t)lround(temp), (int16_t)lround(hum) };
+    history.add(point.time, point.temp, point.hum);
+    source[point.time] = point;
+  }
+
+  for (uint8_t tier = History::TIER_RAW; tier < History::TIER_COUNT; ++tier) {
+    HistoryReader reader(history, (History::tier_t)tier, 0, 0xFFFFFFFF);
+    size_t count = 0, errors = 0;
+    uint32_t first = 0;
+
+    while (reader.next(point)) {
+      if (! count++)
+        first = point.time;
+      if (tier == History::TIER_RAW) {
+        auto it = source.find(point.time);
+
+        if ((it == source.end()) || (it->second.temp != point.temp) || (it->second.hum != point.hum))
+          ++errors;
+      }
+    }
+    count -= history.pending((History::tier_t)tier).count; // Stored ones only
+    printf("tier %u: %zu B, %zu points, %.2f B/point, %.1f h retained", tier, fileSize((History::tier_t)tier), count,
+      (double)fileSize((History::tier_t)tier) / count, (time - first) / 3600.0);
+    if (tier == History::TIER_RAW)
+      printf(", %zu mismatches", errors);
+    printf("\n");
+  }
+
+  {
+    auto start = std::chrono::steady_clock::now();
+    size_t points = 0;
+
+    for (int i = 0; i < 20; ++i) {
+      HistoryReader reader(history, History::TIER_RAW, 0, 0xFFFFFFFF);
+
+      while (reader.next(point))
+        ++points;
+    }
+    printf("decode: %.1f Mpoints/s\n", points / elapsed(start) / 1e6);
+  }
+
+  {
+    auto start = std::chrono::steady_clock::now();
+    size_t bytes = 0, len;
+
+    for (int i = 0; i < QUERIES; ++i) {
+      uint32_t from = time - 40000 + i * 100;
+      HistoryReader reader(history, History::TIER_RAW, from, from + 3600, HistoryReader::FORMAT_CSV);
+
+      while ((len = reader.read(buffer, sizeof(buffer))))
+        bytes += len;
+    }
+    printf("1 h CSV range query: %zu B, %.2f ms\n", bytes / QUERIES, elapsed(start) / QUERIES * 1e3);
+  }
+
+  { // Crash after checkpoint: unfinished blocks continue from pending file
+    History restored;
+    size_t before = 0, after = 0;
+
+    history.save();
+    if (! restored.restore()) {
+      printf("restore failed\n");
+      return 1;
+    }
+    for (uint8_t tier = History::TIER_RAW; tier < History::TIER_COUNT; ++tier) {
+      HistoryReader a(history, (History::tier_t)tier, 0, 0xFFFFFFFF), b(restored, (History::tier_t)tier, 0, 0xFFFFFFFF);
+
+      while (a.next(point))
+        ++before;
+      while (b.next(point))
+        ++after;
+    }
+    printf("restore: %zu of %zu points\n", after, before);
+    return (after == before) ? 0 : 1;
+  }
+}
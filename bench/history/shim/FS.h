@@ -0,0 +1,91 @@
+#pragma once
+
+/*
+ * In-memory file system with the part of FS API used by History
+ */
+
+#include <map>
+#include <string>
+#include "Arduino.h"
+
+class File : public Print {
+public:
+  File(std::string *data = nullptr, bool writable = false) : _data(data), _pos(0), _writable(writable) {}
+
+  operator bool() const {
+    return _data;
+  }
+  size_t write(uint8_t c) override {
+    return write(&c, 1);
+  }
+  size_t write(const uint8_t *buffer, size_t size) override {
+    if (! _writable)
+      return 0;
+    _data->append((const char*)buffer, size);
+    return size;
+  }
+  int read(uint8_t *buffer, size_t size) {
+    size_t len = _min(size, _data->size() - _pos);
+
+    memcpy(buffer, _data->data() + _pos, len);
+    _pos += len;
+    return len;
+  }
+  size_t size() const {
+    return _data->size();
+  }
+  bool seek(uint32_t pos) {
+    if (pos > _data->size())
+      return false;
+    _pos = pos;
+    return true;
+  }
+  bool truncate(uint32_t size) {
+    _data->resize(size);
+    return true;
+  }
+  void close() {
+    _data = nullptr;
+  }
+
+protected:
+  std::string *_data;
+  size_t _pos;
+  bool _writable;
+};
+
+class FS {
+public:
+  File open(const char *path, const char *mode) {
+    if (*mode == 'r') {
+      auto it = _files.find(path);
+
+      return (it == _files.end()) ? File() : File(&it->second);
+    }
+    if (*mode == 'w')
+      _files[path].clear();
+    return File(&_files[path], true);
+  }
+  bool rename(const char *from, const char *to) {
+    auto it = _files.find(from);
+
+    if (it == _files.end())
+      return false;
+    _files[to] = it->second;
+    _files.erase(it);
+    return true;
+  }
+  bool remove(const char *path) {
+    return _files.erase(path);
+  }
+  size_t size(const char *path) const {
+    auto it = _files.find(path);
+
+    return (it == _files.end()) ? 0 : it->second.size();
+  }
+
+protected:
+  std::map<std::string, std::string> _files;
+};
+
+extern FS LittleFS;
@@ -0,0 +1,32 @@
+# Compresses web assets from "web" directory into "data/www" (LittleFS image) before building file system image.
+# Every file is stored gzipped only: server sends it with Content-Encoding (406 if browser does not accept gzip)
+# and uses CRC32 and size from gzip trailer as ETag. Files outside "/www" are never served.
+
+import gzip
+import os
+
+Import("env")
+
+def gzip_web(*args, **kwargs):
+    src_dir = os.path.join(env.subst("$PROJECT_DIR"), "web")
+    data_dir = os.path.join(env.subst("$PROJECT_DATA_DIR"), "www")
+
+    if not os.path.isdir(src_dir):
+        return
+    for root, dirs, files in os.walk(src_dir):
+        for name in files:
+            src = os.path.join(root, name)
+            dst = os.path.join(data_dir, os.path.relpath(src, src_dir))
+            os.makedirs(os.path.dirname(dst), exist_ok=True)
+            for stale in (dst, dst + ".gz"):
+                if os.path.exists(stale):
+                    os.remove(stale)
+            with open(src, "rb") as f:
+                data = f.read()
+            packed = gzip.compress(data, compresslevel=9, mtime=0)  # Already compressed formats (e.g. images) grow by header only
+            with open(dst + ".gz", "wb") as f:
+                f.write(packed)
+            print("Compressed %s: %u -> %u bytes" % (os.path.relpath(src, src_dir), len(data), len(packed)))
+
+if any(target in COMMAND_LINE_TARGETS for target in ("buildfs", "uploadfs", "uploadfsota")):
+    gzip_web()
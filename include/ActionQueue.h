@@ -1,21 +1,55 @@
 #pragma once
 
-#include <functional>
 #include <Arduino.h>
+#include "Delegate.h"
+#ifdef USE_STATS
+#include "TaskStats.h"
+#endif
+
+/*
+ * Action returns delay to its next run, 0 to be removed. Plain delay counts from the deadline it was run for
+ * (fixed period without drift), with ACTION_FROM_NOW flag it counts from the time action returned
+ * (task waiting for its own deadline or polling).
+ */
+const uint32_t ACTION_FROM_NOW = 0x80000000;
 
 template<const uint8_t MAX_ACTIONS = 10>
 class ActionQueue {
 public:
-  typedef std::function<uint32_t()> action_t;
+  typedef Delegate<uint32_t> action_t;
+  typedef uint16_t handle_t; // Generation (high byte) and slot (low byte), 0 is invalid
 
-  ActionQueue() : _count(0) {}
+  static const handle_t INVALID_HANDLE = 0;
+  static const uint32_t IDLE_DEADLINE = 0x7FFFFFFF; // Distance to deadline of empty queue
+
+  ActionQueue() : _count(0) {
+    for (uint8_t i = 0; i < MAX_ACTIONS; ++i) {
+      _actions[i].gen = 1;
+    }
+  }
 
   uint8_t count() const {
     return _count;
   }
+  uint8_t capacity() const {
+    return MAX_ACTIONS;
+  }
   void clear();
-  bool add(action_t action);
-  void remove(action_t action);
+  handle_t add(action_t action, uint32_t delay = 0, PGM_P name = nullptr);
+  bool remove(handle_t handle);
+  bool reschedule(handle_t handle, uint32_t delay); // Next run after delay from now
+  uint32_t nextDeadline() const;
+#ifdef USE_STATS
+  handle_t handle(uint8_t index) const {
+    return ((index < MAX_ACTIONS) && _actions[index].action) ? makeHandle(index, _actions[index].gen) : INVALID_HANDLE;
+  }
+  PGM_P name(handle_t handle) const {
+    return _actions[handle & 0xFF].name;
+  }
+  const TaskStats &stats(handle_t handle) const {
+    return _actions[handle & 0xFF].stats;
+  }
+#endif
 
   void loop();
 
@@ -23,65 +57,169 @@ protected:
   struct action_item_t {
     action_t action;
     uint32_t next;
+    uint8_t gen;
+    uint8_t pos; // Position in heap
+#ifdef USE_STATS
+    PGM_P name;
+    TaskStats stats;
+#endif
   };
 
-  int8_t find(action_t action);
+  static handle_t makeHandle(uint8_t index, uint8_t gen) {
+    return ((handle_t)gen << 8) | index;
+  }
+  bool before(uint8_t a, uint8_t b) const {
+    return (int32_t)(_actions[_heap[a]].next - _actions[_heap[b]].next) < 0;
+  }
+  void swap(uint8_t a, uint8_t b);
+  void siftUp(uint8_t pos);
+  void siftDown(uint8_t pos);
+  void release(uint8_t index);
 
   action_item_t _actions[MAX_ACTIONS];
+  uint8_t _heap[MAX_ACTIONS]; // Slot indexes, min-heap by deadline
   uint8_t _count;
 };
 
 template<const uint8_t MAX_ACTIONS>
-inline void ActionQueue<MAX_ACTIONS>::clear() {
-  _count = 0;
+void ActionQueue<MAX_ACTIONS>::clear() {
+  while (_count) {
+    release(_heap[--_count]);
+  }
 }
 
 template<const uint8_t MAX_ACTIONS>
-bool ActionQueue<MAX_ACTIONS>::add(action_t action) {
-  if (_count < MAX_ACTIONS) {
-    _actions[_count].action = action;
-    _actions[_count].next = 0;
-    ++_count;
+typename ActionQueue<MAX_ACTIONS>::handle_t ActionQueue<MAX_ACTIONS>::add(action_t action, uint32_t delay, PGM_P name) {
+  if (action && (_count < MAX_ACTIONS)) {
+    for (uint8_t i = 0; i < MAX_ACTIONS; ++i) {
+      if (! _actions[i].action) {
+        _actions[i].action = action;
+        _actions[i].next = millis() + delay;
+        _actions[i].pos = _count;
+#ifdef USE_STATS
+        _actions[i].name = name ? name : PSTR("action");
+        _actions[i].stats.clear();
+#endif
+        _heap[_count] = i;
+        siftUp(_count++);
+        return makeHandle(i, _actions[i].gen);
+      }
+    }
   }
-  return false;
+  return INVALID_HANDLE;
 }
 
 template<const uint8_t MAX_ACTIONS>
-void ActionQueue<MAX_ACTIONS>::remove(action_t action) {
-  int8_t index = find(action);
+bool ActionQueue<MAX_ACTIONS>::remove(handle_t handle) {
+  uint8_t index = handle & 0xFF;
+
+  if ((index < MAX_ACTIONS) && _actions[index].action && (_actions[index].gen == (handle >> 8))) {
+    uint8_t pos = _actions[index].pos;
 
-  if (index >= 0) {
-    if (index < _count - 1) {
-      memmove(&_actions[index], &_actions[index + 1], sizeof(action_item_t) * (_count - index - 1));
+    release(index);
+    if (pos < --_count) {
+      swap(pos, _count);
+      siftUp(pos);
+      siftDown(pos);
     }
-    --_count;
+    return true;
   }
+  return false;
+}
+
+template<const uint8_t MAX_ACTIONS>
+bool ActionQueue<MAX_ACTIONS>::reschedule(handle_t handle, uint32_t delay) {
+  uint8_t index = handle & 0xFF;
+
+  if ((index < MAX_ACTIONS) && _actions[index].action && (_actions[index].gen == (handle >> 8))) {
+    _actions[index].next = millis() + delay;
+    siftUp(_actions[index].pos);
+    siftDown(_actions[index].pos);
+    return true;
+  }
+  return false;
+}
+
+template<const uint8_t MAX_ACTIONS>
+uint32_t ActionQueue<MAX_ACTIONS>::nextDeadline() const {
+  if (_count)
+    return _actions[_heap[0]].next;
+  return millis() + IDLE_DEADLINE;
 }
 
 template<const uint8_t MAX_ACTIONS>
 void ActionQueue<MAX_ACTIONS>::loop() {
-  for (uint8_t i = 0; i < _count; ++i) {
-    if ((int32_t)(_actions[i].next - millis()) <= 0) {
-      uint32_t period;
-
-      period = _actions[i].action();
-      if (period)
-        _actions[i].next = millis() + period;
-      else { // Remove action
-        if (i < _count - 1)
-          memmove(&_actions[i], &_actions[i + 1], sizeof(action_item_t) * (_count - i - 1));
-        --_count;
-        --i; // for() step workaround
+  uint32_t now = millis();
+
+  while (_count && ((int32_t)(_actions[_heap[0]].next - now) <= 0)) {
+    uint8_t index = _heap[0];
+    uint8_t gen = _actions[index].gen;
+    uint32_t period;
+#ifdef USE_STATS
+    uint32_t lateness = now - _actions[index].next;
+    uint32_t start = TaskStats::start();
+#endif
+
+    period = _actions[index].action();
+    now = millis();
+#ifdef USE_STATS
+    _actions[index].stats.stop(start, lateness, period && (! (period & ACTION_FROM_NOW)) && ((int32_t)(_actions[index].next + period - now) <= 0)); // Before removal check, last run counts too
+#endif
+    if (_actions[index].gen != gen) // Removed by itself
+      continue;
+    if (period) {
+      if (period & ACTION_FROM_NOW) {
+        period &= ~ACTION_FROM_NOW;
+        _actions[index].next = now + period;
+      } else {
+        _actions[index].next += period; // Drift-free
       }
+      if ((int32_t)(_actions[index].next - now) <= 0) // Overrun, skip missed periods
+        _actions[index].next = now + period;
+      siftDown(_actions[index].pos);
+    } else { // Remove action
+      remove(makeHandle(index, gen));
     }
   }
 }
 
 template<const uint8_t MAX_ACTIONS>
-int8_t ActionQueue<MAX_ACTIONS>::find(action_t action) {
-  for (uint8_t i = 0; i < _count; ++i) {
-    if (_actions[i].action == action)
-      return i;
+void ActionQueue<MAX_ACTIONS>::swap(uint8_t a, uint8_t b) {
+  uint8_t index = _heap[a];
+
+  _heap[a] = _heap[b];
+  _heap[b] = index;
+  _actions[_heap[a]].pos = a;
+  _actions[_heap[b]].pos = b;
+}
+
+template<const uint8_t MAX_ACTIONS>
+void ActionQueue<MAX_ACTIONS>::siftUp(uint8_t pos) {
+  while (pos && before(pos, (pos - 1) / 2)) {
+    swap(pos, (pos - 1) / 2);
+    pos = (pos - 1) / 2;
   }
-  return -1;
+}
+
+template<const uint8_t MAX_ACTIONS>
+void ActionQueue<MAX_ACTIONS>::siftDown(uint8_t pos) {
+  while (true) {
+    uint8_t child = pos * 2 + 1;
+
+    if (child >= _count)
+      break;
+    if ((child + 1 < _count) && before(child + 1, child))
+      ++child;
+    if (! before(child, pos))
+      break;
+    swap(pos, child);
+    pos = child;
+  }
+}
+
+template<const uint8_t MAX_ACTIONS>
+inline void ActionQueue<MAX_ACTIONS>::release(uint8_t index) {
+  _actions[index].action = nullptr;
+  if (! ++_actions[index].gen) // Invalidate outstanding handles, never issue handle 0
+    _actions[index].gen = 1;
 }
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <inttypes.h>
+
+uint16_t crc16(uint8_t value, uint16_t crc = 0xFFFF);
+uint16_t crc16(const uint8_t *data, uint16_t size, uint16_t crc = 0xFFFF);
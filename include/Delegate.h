@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string.h>
+#include <new>
+#include <type_traits>
+
+template<typename R, const uint8_t SIZE = sizeof(void*) * 2>
+class Delegate {
+public:
+  typedef R (*method_t)(void *ctx);
+
+  Delegate() : _invoke(nullptr) {}
+  Delegate(decltype(nullptr)) : _invoke(nullptr) {}
+  Delegate(method_t method, void *ctx);
+  template<typename F>
+  Delegate(const F &func);
+
+  explicit operator bool() const {
+    return _invoke != nullptr;
+  }
+  R operator()() {
+    return _invoke(_storage);
+  }
+
+protected:
+  typedef R (*invoke_t)(void *storage);
+
+  struct bound_t {
+    method_t method;
+    void *ctx;
+  };
+
+  template<typename F>
+  static R invoke(void *storage) {
+    return (*(F*)storage)();
+  }
+  static R invokeBound(void *storage) {
+    return ((bound_t*)storage)->method(((bound_t*)storage)->ctx);
+  }
+
+  invoke_t _invoke;
+  union {
+    uint8_t _storage[SIZE];
+    void *_align;
+  };
+};
+
+template<typename R, const uint8_t SIZE>
+Delegate<R, SIZE>::Delegate(method_t method, void *ctx) : _invoke(&Delegate::invokeBound) {
+  static_assert(sizeof(bound_t) <= SIZE, "Delegate storage too small");
+
+  ((bound_t*)_storage)->method = method;
+  ((bound_t*)_storage)->ctx = ctx;
+}
+
+template<typename R, const uint8_t SIZE>
+template<typename F>
+Delegate<R, SIZE>::Delegate(const F &func) {
+  typedef typename std::decay<F>::type func_t;
+
+  static_assert(sizeof(func_t) <= SIZE, "Delegate storage too small");
+  static_assert(std::is_trivially_copyable<func_t>::value && std::is_trivially_destructible<func_t>::value, "Only trivial callables are allowed");
+
+  new (_storage) func_t(func);
+  _invoke = &Delegate::invoke<func_t>;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+#include <LittleFS.h>
+
+/*
+ * Sensor history on flash. Points (time and temperature/humidity in hundredths) are kept in tiers:
+ * raw samples, 1 min. and 15 min. means. Tier file is a sequence of fixed size blocks (one flash page),
+ * block header holds first point and time range, next points are zigzag varints of time delta-of-delta
+ * and values delta. Unfinished blocks stay in RAM, full ones are appended to file, file is rotated when full.
+ * Unfinished blocks are also saved periodically to pending file, so a crash loses only points since last save.
+ */
+class History {
+public:
+  enum tier_t { TIER_RAW, TIER_MINUTE, TIER_QUARTER, TIER_COUNT };
+
+  struct point_t {
+    uint32_t time;
+    int16_t temp;
+    int16_t hum;
+  };
+
+  static const uint16_t BLOCK_SIZE = 256; // Flash page
+  static const uint8_t BLOCK_HEADER = 14;
+  static const uint32_t FILE_SIZE = 65536; // Per tier file (current and old one)
+
+  struct __attribute__((__packed__)) block_t {
+    uint32_t first; // Time of first point
+    uint32_t last; // Time of last point
+    int16_t temp; // First point values
+    int16_t hum;
+    uint8_t count; // Points in block
+    uint8_t length; // Encoded bytes in data
+    uint16_t crc; // Of all above and data
+    uint8_t data[BLOCK_SIZE - BLOCK_HEADER - 2];
+  };
+
+  History(FS &fs = LittleFS);
+
+  bool add(uint32_t time, int16_t temp, int16_t hum);
+  bool flush(); // Store unfinished blocks (on halt)
+  bool save(); // Copy unfinished blocks to pending file (periodically)
+  bool restore(); // Continue unfinished blocks from pending file (on boot)
+  const block_t &pending(tier_t tier) const {
+    return _tiers[tier].block;
+  }
+  FS &fs() const {
+    return _fs;
+  }
+
+  static uint16_t period(tier_t tier); // Sample period (in sec.)
+  static void path(char *str, tier_t tier, bool old = false);
+  static bool valid(const block_t &block);
+  static uint8_t zigzag(uint8_t *data, int32_t value);
+  static uint8_t unzigzag(const uint8_t *data, uint8_t size, int32_t *value);
+
+protected:
+  struct tier_state_t {
+    block_t block;
+    int32_t delta; // Last time delta
+    int16_t temp; // Last point values
+    int16_t hum;
+  };
+  struct average_t {
+    uint32_t start; // Period start time
+    int32_t temp;
+    int32_t hum;
+    uint16_t count;
+  };
+
+  bool append(tier_t tier, uint32_t time, int16_t temp, int16_t hum);
+  bool average(tier_t tier, uint32_t time, int16_t temp, int16_t hum);
+  bool store(tier_t tier);
+  uint32_t stored(tier_t tier); // Time of last point in tier file
+
+  FS &_fs;
+  tier_state_t _tiers[TIER_COUNT];
+  average_t _averages[TIER_COUNT]; // Accumulated for tiers except raw
+};
+
+/*
+ * Streams points of one tier within time range as CSV or JSON: old file, current file and pending block.
+ * Blocks are located by binary search on block headers, only one block is kept in RAM.
+ */
+class HistoryReader {
+public:
+  enum format_t { FORMAT_CSV, FORMAT_JSON };
+
+  HistoryReader(const History &history, History::tier_t tier, uint32_t from, uint32_t to, format_t format = FORMAT_CSV);
+
+  bool next(History::point_t &point);
+  size_t read(uint8_t *data, size_t size); // Formatted output, 0 at end
+
+protected:
+  enum source_t { SOURCE_OLD, SOURCE_CURRENT, SOURCE_PENDING, SOURCE_END };
+
+  bool nextBlock();
+  bool openFile(bool old);
+  bool readBlock(uint32_t index);
+  uint8_t format(char *str, const History::point_t &point);
+
+  const History &_history;
+  File _file;
+  History::block_t _block;
+  History::point_t _point; // Last decoded point
+  int32_t _delta;
+  uint32_t _from, _to;
+  uint32_t _index, _blocks; // Next block in file and file blocks
+  uint32_t _emitted; // Time of last returned point
+  uint8_t _pos; // Decoded points in block
+  uint8_t _offset; // Decoded bytes in block
+  History::tier_t _tier : 2;
+  source_t _source : 2;
+  format_t _format : 1;
+  bool _first : 1; // No point formatted yet
+  bool _done : 1; // Footer formatted
+  char _line[40]; // Formatted but not read yet
+  uint8_t _linePos, _lineLen;
+};
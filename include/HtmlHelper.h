@@ -7,25 +7,38 @@ static const char TEXT_HTML[] PROGMEM = "text/html";
 static const char TEXT_CSS[] PROGMEM = "text/css";
 static const char TEXT_JS[] PROGMEM = "text/javascript";
 static const char TEXT_JSON[] PROGMEM = "application/json";
+static const char TEXT_CSV[] PROGMEM = "text/csv";
+static const char APP_BINARY[] PROGMEM = "application/octet-stream";
 
 static const char HTML_TAG_END[] PROGMEM = ">\n";
-static const char HTML_PAGE_START[] PROGMEM = "<!DOCTYPE html>\n"
-  "<html>\n"
-  "<head>\n"
-  "<title>";
-static const char HTML_PAGE_CONT[] PROGMEM = "</title>\n"
-  "<meta charset=\"Windows-1251\">\n"
-  "<meta name=\"viewport\" content=\"width=device-width,initial-scale=1\">\n";
-static const char HTML_STYLE_START[] PROGMEM = "<style>\n";
-static const char HTML_STYLE_END[] PROGMEM = "</style>\n";
-static const char HTML_SCRIPT_START[] PROGMEM = "<script>\n";
-static const char HTML_SCRIPT_END[] PROGMEM = "</script>\n";
-static const char HTML_BODY_START[] PROGMEM = "</head>\n"
-  "<body";
-static const char HTML_BODY[] PROGMEM = "</head>\n"
-  "<body>\n";
-static const char HTML_PAGE_END[] PROGMEM = "</body>\n"
-  "</html>";
+// Fragments are also available as literals to build PROGMEM page templates
+#define HTML_PAGE_START_STR "<!DOCTYPE html>\n" \
+  "<html>\n" \
+  "<head>\n" \
+  "<title>"
+#define HTML_PAGE_CONT_STR "</title>\n" \
+  "<meta charset=\"Windows-1251\">\n" \
+  "<meta name=\"viewport\" content=\"width=device-width,initial-scale=1\">\n"
+#define HTML_STYLE_START_STR "<style>\n"
+#define HTML_STYLE_END_STR "</style>\n"
+#define HTML_SCRIPT_START_STR "<script>\n"
+#define HTML_SCRIPT_END_STR "</script>\n"
+#define HTML_BODY_START_STR "</head>\n" \
+  "<body"
+#define HTML_BODY_STR "</head>\n" \
+  "<body>\n"
+#define HTML_PAGE_END_STR "</body>\n" \
+  "</html>"
+
+static const char HTML_PAGE_START[] PROGMEM = HTML_PAGE_START_STR;
+static const char HTML_PAGE_CONT[] PROGMEM = HTML_PAGE_CONT_STR;
+static const char HTML_STYLE_START[] PROGMEM = HTML_STYLE_START_STR;
+static const char HTML_STYLE_END[] PROGMEM = HTML_STYLE_END_STR;
+static const char HTML_SCRIPT_START[] PROGMEM = HTML_SCRIPT_START_STR;
+static const char HTML_SCRIPT_END[] PROGMEM = HTML_SCRIPT_END_STR;
+static const char HTML_BODY_START[] PROGMEM = HTML_BODY_START_STR;
+static const char HTML_BODY[] PROGMEM = HTML_BODY_STR;
+static const char HTML_PAGE_END[] PROGMEM = HTML_PAGE_END_STR;
 
 static const char JS_VALIDATE_INT[] PROGMEM = "function validateInt(field,minval,maxval){\n"
   "let val=parseInt(field.value);\n"
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Print.h>
+
+/*
+ * Streaming JSON writer: prints straight to any Print (response stream, Serial), keeps only nesting state.
+ * Keys are PROGMEM strings, commas are inserted automatically.
+ */
+class JsonWriter {
+public:
+  static const uint8_t MAX_DEPTH = 16;
+
+  JsonWriter(Print &out) : _out(out), _first(1), _depth(0), _key(false) {}
+
+  void beginObject();
+  void endObject();
+  void beginArray();
+  void endArray();
+  void key(PGM_P name);
+  void value(int value);
+  void value(unsigned int value);
+  void value(long value);
+  void value(unsigned long value);
+  void value(bool value);
+  void value(const char *str); // Escaped
+  void valueP(PGM_P str); // Escaped
+  void fixed(int32_t value, uint8_t decimals); // e.g. hundredths as number with two decimals
+  void null();
+
+protected:
+  void separate(); // Comma before value (unless it follows key)
+  void begin(char c);
+  void end(char c);
+  void escape(const char *str, bool progmem);
+
+  Print &_out;
+  uint16_t _first; // Bit per nesting level, no value yet
+  uint8_t _depth;
+  bool _key; // Key printed, value expected
+};
+
+/*
+ * SAX style JSON parser: input is fed in chunks of any size (e.g. request body), values are passed to handler
+ * as soon as they are complete, nothing is allocated. Strings and numbers must fit the token buffer,
+ * keys must fit the key buffer, otherwise input is rejected.
+ */
+class JsonParser {
+public:
+  enum event_t : uint8_t { JSON_OBJECT, JSON_OBJECT_END, JSON_ARRAY, JSON_ARRAY_END, JSON_STRING, JSON_NUMBER, JSON_TRUE, JSON_FALSE, JSON_NULL };
+
+  // key is member name inside object (nullptr in array or at the end of container), depth is 0 for top level value,
+  // value is text of string or number (nullptr for others), false to reject input
+  typedef bool (*handler_t)(void *arg, event_t event, uint8_t depth, const char *key, const char *value);
+
+  static const uint8_t MAX_DEPTH = 16;
+  static const uint8_t KEY_SIZE = 32;
+  static const uint8_t TOKEN_SIZE = 64;
+
+  JsonParser(handler_t handler, void *arg = nullptr);
+
+  bool parse(const char *data, size_t size); // Next chunk, false on error (rest of input is ignored)
+  bool done() const { // Top level object or array is complete
+    return _state == STATE_DONE;
+  }
+  bool error() const {
+    return _state == STATE_ERROR;
+  }
+
+protected:
+  enum state_t : uint8_t { STATE_VALUE, STATE_VALUE_OR_END, STATE_KEY, STATE_KEY_OR_END, STATE_COLON, STATE_NEXT,
+    STATE_STRING, STATE_ESCAPE, STATE_UNICODE, STATE_NUMBER, STATE_LITERAL, STATE_DONE, STATE_ERROR };
+
+  bool step(char c);
+  bool append(char c);
+  bool emit(event_t event, const char *value = nullptr);
+  bool open(bool object);
+  bool close(bool object);
+  bool endValue();
+  bool inObject() const {
+    return _depth && (_objects & (1 << (_depth - 1)));
+  }
+  static bool validNumber(const char *str);
+
+  handler_t _handler;
+  void *_arg;
+  uint16_t _objects; // Bit per nesting level, object or array
+  uint16_t _unicode; // Code of \u escape
+  state_t _state;
+  uint8_t _depth;
+  uint8_t _len; // Of token being parsed
+  uint8_t _hex; // Digits of \u escape
+  bool _isKey; // String being parsed is key
+  char _keyBuf[KEY_SIZE];
+  char _token[TOKEN_SIZE];
+};
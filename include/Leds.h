@@ -6,10 +6,18 @@
 template<const uint8_t CAPACITY>
 class Leds {
 public:
-  enum ledmode_t { LED_OFF, LED_ON, LED_TOGGLE, LED_PWM, LED_05HZ, LED_1HZ, LED_2HZ, LED_4HZ, LED_FADEIN, LED_FADEOUT, LED_BREATH };
+  enum ledmode_t { LED_OFF, LED_ON, LED_TOGGLE, LED_PWM, LED_05HZ, LED_1HZ, LED_2HZ, LED_4HZ, LED_FADEIN, LED_FADEOUT, LED_BREATH, LED_PATTERN };
 
-  Leds() : _ticker(Ticker()), _count(0), _pulses(0) {
-    analogWriteRange(255);
+  struct __attribute__((__packed__)) keyframe_t {
+    uint8_t level; // Linear brightness (0..255)
+    uint16_t time : 15; // Duration (in ms.), 0 terminates pattern
+    bool fade : 1; // Fade to next keyframe level (or terminator level), otherwise hold
+  };
+
+  static const uint16_t MAX_DUTY = 1023;
+
+  Leds() : _ticker(Ticker()), _count(0) {
+    analogWriteRange(MAX_DUTY);
   }
   ~Leds() {
     clear();
@@ -24,6 +32,7 @@ public:
   int8_t find(uint8_t pin) const;
   ledmode_t getMode(uint8_t index) const;
   void setMode(uint8_t index, ledmode_t mode, bool force = false);
+  void setPattern(uint8_t index, const keyframe_t *pattern);
   uint8_t getDuty(uint8_t index) const;
   void setDuty(uint8_t index, uint8_t duty);
 
@@ -33,23 +42,34 @@ protected:
     bool level : 1;
     ledmode_t mode : 4;
     uint8_t duty;
+    uint16_t output; // Last written PWM value
+    const keyframe_t *pattern; // PROGMEM
+    uint32_t total; // Pattern duration (in ms.)
+    uint32_t start; // Beginning of pattern
   };
 
+  static const uint8_t FADE_STEP = 20; // Shortest fade step (in ms.)
+
+  static const keyframe_t *modePattern(ledmode_t mode);
+  static uint32_t patternTime(const keyframe_t *pattern);
+  static uint16_t gamma(uint16_t level);
   bool timerNeeded();
+  void update();
+  uint32_t updateLed(uint8_t index, uint32_t now);
+  void write(uint8_t index, uint16_t output);
 
   static void tickerCallback(Leds *_this);
 
   led_t _items[CAPACITY];
   Ticker _ticker;
   uint8_t _count;
-  volatile uint8_t _pulses;
 };
 
 template<const uint8_t CAPACITY>
 void Leds<CAPACITY>::clear() {
   _ticker.detach();
   for (uint8_t i = 0; i < _count; ++i) {
-    if ((_items[i].mode == LED_PWM) || (_items[i].mode >= LED_FADEIN)) {
+    if ((_items[i].mode == LED_PWM) || (_items[i].mode >= LED_05HZ)) {
       analogWrite(_items[i].pin, 0);
     }
     pinMode(_items[i].pin, INPUT);
@@ -64,6 +84,7 @@ int8_t Leds<CAPACITY>::add(uint8_t pin, bool level, ledmode_t mode) {
     _items[_count].level = level;
     _items[_count].mode = mode;
     _items[_count].duty = 0;
+    _items[_count].pattern = nullptr;
     pinMode(pin, OUTPUT);
     setMode(_count++, mode, true);
     return _count - 1;
@@ -74,7 +95,7 @@ int8_t Leds<CAPACITY>::add(uint8_t pin, bool level, ledmode_t mode) {
 template<const uint8_t CAPACITY>
 void Leds<CAPACITY>::remove(uint8_t index) {
   if (index < _count) {
-    if ((_items[index].mode == LED_PWM) || (_items[index].mode >= LED_FADEIN)) {
+    if ((_items[index].mode == LED_PWM) || (_items[index].mode >= LED_05HZ)) {
       analogWrite(_items[index].pin, 0);
     }
     pinMode(_items[index].pin, INPUT);
@@ -111,17 +132,32 @@ void Leds<CAPACITY>::setMode(uint8_t index, ledmode_t mode, bool force) {
       else if (mode == LED_TOGGLE)
         digitalWrite(_items[index].pin, ! digitalRead(_items[index].pin));
       else if (mode == LED_PWM)
-        analogWrite(_items[index].pin, _items[index].duty);
+        analogWrite(_items[index].pin, ((uint16_t)_items[index].duty << 2) | (_items[index].duty >> 6));
+      else {
+        if (mode != LED_PATTERN)
+          _items[index].pattern = modePattern(mode);
+        _items[index].total = patternTime(_items[index].pattern);
+        _items[index].output = 0xFFFF; // Force first write
+        _items[index].start = millis();
+      }
       _items[index].mode = mode;
       _ticker.detach();
       if (timerNeeded())
-        _ticker.attach_ms(50, &Leds::tickerCallback, this); // 50 ms.
+        update();
     } else if (mode == LED_TOGGLE) {
       digitalWrite(_items[index].pin, ! digitalRead(_items[index].pin));
     }
   }
 }
 
+template<const uint8_t CAPACITY>
+void Leds<CAPACITY>::setPattern(uint8_t index, const keyframe_t *pattern) {
+  if ((index < _count) && ((_items[index].mode != LED_PATTERN) || (_items[index].pattern != pattern))) {
+    _items[index].pattern = pattern;
+    setMode(index, LED_PATTERN, true);
+  }
+}
+
 template<const uint8_t CAPACITY>
 uint8_t Leds<CAPACITY>::getDuty(uint8_t index) const {
   if ((index < _count) && (_items[index].mode == LED_PWM)) {
@@ -133,11 +169,59 @@ uint8_t Leds<CAPACITY>::getDuty(uint8_t index) const {
 template<const uint8_t CAPACITY>
 void Leds<CAPACITY>::setDuty(uint8_t index, uint8_t duty) {
   if ((index < _count) && (_items[index].mode == LED_PWM)) {
-    analogWrite(_items[index].pin, duty);
+    analogWrite(_items[index].pin, ((uint16_t)duty << 2) | (duty >> 6));
     _items[index].duty = duty;
   }
 }
 
+template<const uint8_t CAPACITY>
+const typename Leds<CAPACITY>::keyframe_t *Leds<CAPACITY>::modePattern(ledmode_t mode) {
+  static const keyframe_t BLINK_05HZ[] PROGMEM = { { 255, 50, false }, { 0, 1950, false }, { 0, 0, false } };
+  static const keyframe_t BLINK_1HZ[] PROGMEM = { { 255, 50, false }, { 0, 950, false }, { 0, 0, false } };
+  static const keyframe_t BLINK_2HZ[] PROGMEM = { { 255, 50, false }, { 0, 450, false }, { 0, 0, false } };
+  static const keyframe_t BLINK_4HZ[] PROGMEM = { { 255, 50, false }, { 0, 200, false }, { 0, 0, false } };
+  static const keyframe_t FADEIN[] PROGMEM = { { 0, 1000, true }, { 255, 0, false } };
+  static const keyframe_t FADEOUT[] PROGMEM = { { 255, 1000, true }, { 0, 0, false } };
+  static const keyframe_t BREATH[] PROGMEM = { { 0, 1000, true }, { 255, 1000, true }, { 0, 0, false } };
+
+  switch (mode) {
+    case LED_05HZ:
+      return BLINK_05HZ;
+    case LED_1HZ:
+      return BLINK_1HZ;
+    case LED_2HZ:
+      return BLINK_2HZ;
+    case LED_4HZ:
+      return BLINK_4HZ;
+    case LED_FADEIN:
+      return FADEIN;
+    case LED_FADEOUT:
+      return FADEOUT;
+    case LED_BREATH:
+      return BREATH;
+    default:
+      return nullptr;
+  }
+}
+
+template<const uint8_t CAPACITY>
+uint32_t Leds<CAPACITY>::patternTime(const keyframe_t *pattern) {
+  keyframe_t frame;
+  uint32_t result = 0;
+
+  if (pattern) {
+    for (memcpy_P(&frame, pattern, sizeof(frame)); frame.time; memcpy_P(&frame, ++pattern, sizeof(frame))) {
+      result += frame.time;
+    }
+  }
+  return result;
+}
+
+template<const uint8_t CAPACITY>
+inline uint16_t Leds<CAPACITY>::gamma(uint16_t level) { // 8.8 fixed point linear level to 10-bit output (gamma 2)
+  return ((uint32_t)level * level) >> 22;
+}
+
 template<const uint8_t CAPACITY>
 bool Leds<CAPACITY>::timerNeeded() {
   for (uint8_t i = 0; i < _count; ++i) {
@@ -148,30 +232,66 @@ bool Leds<CAPACITY>::timerNeeded() {
 }
 
 template<const uint8_t CAPACITY>
-void Leds<CAPACITY>::tickerCallback(Leds *_this) {
-  static const uint8_t SINUS[] PROGMEM = { 0, 1, 2, 8, 17, 30, 46, 64, 84, 105, 128, 150, 171, 191, 209, 225, 238, 247, 253, 255 };
-
-  for (uint8_t i = 0; i < _this->_count; ++i) {
-    if (_this->_items[i].mode >= LED_05HZ) {
-      if (_this->_items[i].mode == LED_05HZ) {
-        digitalWrite(_this->_items[i].pin, (_this->_pulses == 0) == _this->_items[i].level);
-      } else if (_this->_items[i].mode == LED_1HZ) {
-        digitalWrite(_this->_items[i].pin, ((_this->_pulses % 20) == 0) == _this->_items[i].level);
-      } else if (_this->_items[i].mode == LED_2HZ) {
-        digitalWrite(_this->_items[i].pin, ((_this->_pulses % 10) == 0) == _this->_items[i].level);
-      } else if (_this->_items[i].mode == LED_4HZ) {
-        digitalWrite(_this->_items[i].pin, ((_this->_pulses % 5) == 0) == _this->_items[i].level);
-      } else {
-        if (_this->_items[i].mode == LED_FADEIN)
-          _this->_items[i].duty = pgm_read_byte(&SINUS[_this->_pulses % 20]);
-        else if (_this->_items[i].mode == LED_FADEOUT)
-          _this->_items[i].duty = pgm_read_byte(&SINUS[19 - _this->_pulses % 20]);
-        else if (_this->_items[i].mode == LED_BREATH)
-          _this->_items[i].duty = _this->_pulses >= 20 ? pgm_read_byte(&SINUS[19 - _this->_pulses % 20]) : pgm_read_byte(&SINUS[_this->_pulses % 20]);
-        analogWrite(_this->_items[i].pin, _this->_items[i].duty);
-      }
+void Leds<CAPACITY>::update() {
+  uint32_t now = millis();
+  uint32_t wait = 0xFFFFFFFF;
+
+  for (uint8_t i = 0; i < _count; ++i) {
+    if (_items[i].mode >= LED_05HZ) {
+      uint32_t next = updateLed(i, now);
+
+      if (next < wait)
+        wait = next;
     }
   }
-  if (++_this->_pulses >= 40)
-    _this->_pulses = 0;
+  if (wait != 0xFFFFFFFF)
+    _ticker.once_ms(wait, &Leds::tickerCallback, this);
+}
+
+template<const uint8_t CAPACITY>
+uint32_t Leds<CAPACITY>::updateLed(uint8_t index, uint32_t now) {
+  const keyframe_t *pattern = _items[index].pattern;
+  keyframe_t frame, next;
+  uint32_t phase;
+
+  if (! _items[index].total) { // Empty pattern
+    write(index, 0);
+    return 0xFFFFFFFF;
+  }
+  phase = (now - _items[index].start) % _items[index].total; // Total is cached, pattern is walked only up to phase
+  memcpy_P(&frame, pattern, sizeof(frame));
+  while (phase >= frame.time) {
+    phase -= frame.time;
+    memcpy_P(&frame, ++pattern, sizeof(frame));
+  }
+  if (frame.fade) {
+    uint16_t from, to, step;
+
+    memcpy_P(&next, pattern + 1, sizeof(next));
+    from = frame.level * 257; // 8.8 fixed point
+    to = next.level * 257;
+    write(index, gamma(from + ((int32_t)(to - from) * (int32_t)phase) / frame.time));
+    from = gamma(from);
+    to = gamma(to);
+    step = frame.time / _max(from > to ? from - to : to - from, 1); // Time per output change
+    if (step < FADE_STEP)
+      step = FADE_STEP;
+    return _min((uint32_t)step, frame.time - phase);
+  } else {
+    write(index, gamma(frame.level * 257));
+    return frame.time - phase; // Hold until next keyframe
+  }
+}
+
+template<const uint8_t CAPACITY>
+void Leds<CAPACITY>::write(uint8_t index, uint16_t output) {
+  if (output != _items[index].output) {
+    _items[index].output = output;
+    analogWrite(_items[index].pin, _items[index].level ? output : MAX_DUTY - output);
+  }
+}
+
+template<const uint8_t CAPACITY>
+void Leds<CAPACITY>::tickerCallback(Leds *_this) {
+  _this->update();
 }
@@ -1,71 +1,475 @@
 #pragma once
 
+#include <stddef.h>
+#include <Arduino.h>
+#include <coredecls.h>
 #include <Print.h>
 
-template<const uint16_t MAX_SIZE = 4096>
+/*
+ * Text is stored as is. Events (event_P()) are stored in binary form:
+ * marker, PROGMEM format pointer, timestamp and up to MAX_ARGS integer arguments,
+ * and formatted only when log is read (forEach()) or sent to duplicate output.
+ *
+ * Duplicate output (usually Serial) must implement availableForWrite(),
+ * mirrored data is queued and sent only as fast as it can accept it.
+ *
+ * rtcSave() copies the most recent records to RTC user memory (cheap enough to call
+ * periodically and from crash handler), rtcRestore() appends them to log after reboot.
+ */
+template<const uint16_t MAX_SIZE = 4096, const uint16_t DUP_SIZE = 512>
 class Logger : public Print {
 public:
-  Logger(Print *dup = nullptr) : Print(), _dup(dup), _buffer(nullptr) {}
+  static const uint8_t MAX_ARGS = 4;
+  static const uint8_t MAX_EVENT_LENGTH = 96; // Formatted event
+
+  typedef void (*queuedcb_t)(); // Mirrored data started waiting in queue
+
+  Logger(Print *dup = nullptr) : Print(), _dup(dup), _buffer(nullptr), _dup_buffer(nullptr), _total(0), _dup_dropped(0), _build(0), _onqueued(nullptr) {}
   ~Logger() {
     if (_buffer)
-      delete _buffer;
+      delete[] _buffer;
+    if (_dup_buffer)
+      delete[] _dup_buffer;
   }
 
   bool begin();
   void clear();
   uint16_t length() const;
-  operator const char*();
+  uint32_t position() const { // Total stored bytes
+    return _total;
+  }
+  uint32_t next(uint32_t since) const; // Position after text line or event at since
+  template<typename F>
+  void forEach(F callback, uint32_t since = 0, uint32_t until = 0) const; // Up to the end if until is 0
   size_t write(uint8_t val);
+  size_t write(const uint8_t *buffer, size_t size);
+  template<typename... Args>
+  void event_P(PGM_P fmt, Args... args);
+  void flush();
+  bool rtcSave(uint8_t offset, uint16_t size) const;
+  bool rtcRestore(uint8_t offset, uint16_t size);
+
+  uint16_t pending() const {
+    return _dup_length + (_dup_line_len - _dup_line_pos);
+  }
+  uint32_t dropped() const {
+    return _dup_dropped;
+  }
+  void onQueued(queuedcb_t cb) { // To schedule loop() only while something is pending
+    _onqueued = cb;
+  }
+  void loop();
 
 protected:
+  static const char EVENT_MARKER = '\x1E';
+
+  struct __attribute__((__packed__)) event_t {
+    char marker;
+    PGM_P fmt;
+    uint32_t time;
+    uint8_t argc;
+    uint32_t argv[MAX_ARGS];
+  };
+
+  static const uint8_t EVENT_HEADER = offsetof(event_t, argv);
+
+  struct __attribute__((__packed__)) rtc_log_t {
+    uint32_t build;
+    uint16_t length;
+    uint16_t reserved;
+    uint32_t crc; // Header and data
+  };
+
+  static const uint8_t RTC_CHUNK = 32;
+
+  static void ringPut(char *ring, uint16_t size, uint16_t start, uint16_t length, const char *data, uint16_t len);
+  static void ringGet(const char *ring, uint16_t size, uint16_t start, uint16_t offset, void *data, uint16_t len);
+  static uint8_t eventSize(const char *ring, uint16_t size, uint16_t start, uint16_t offset);
+  static uint8_t formatEvent(const char *ring, uint16_t size, uint16_t start, uint16_t offset, char *str);
+
+  uint16_t nextRecord(uint16_t offset) const;
+
+  void evict();
+  void put(const char *data, uint16_t size);
+  void dupPut(const char *data, uint16_t size);
+
   Print *_dup;
   char *_buffer;
+  char *_dup_buffer;
+  uint16_t _start; // Oldest char
   uint16_t _length;
+  uint32_t _total;
+  uint16_t _dup_start;
+  uint16_t _dup_length;
+  uint32_t _dup_dropped;
+  char _dup_line[MAX_EVENT_LENGTH]; // Formatted event to send
+  uint8_t _dup_line_pos;
+  uint8_t _dup_line_len;
+  uint32_t _build; // Firmware image id: events keep PROGMEM pointers, valid only for the same image
+  queuedcb_t _onqueued;
 };
 
-template<const uint16_t MAX_SIZE>
-bool Logger<MAX_SIZE>::begin() {
+template<const uint16_t MAX_SIZE, const uint16_t DUP_SIZE>
+bool Logger<MAX_SIZE, DUP_SIZE>::begin() {
+  String md5 = ESP.getSketchMD5(); // Of whole image (calculated once by core), unlike build time it changes with any code
+
   if (! _buffer) {
     _buffer = new char[MAX_SIZE];
     if (! _buffer)
       return false;
   }
+  if (_dup && (! _dup_buffer)) {
+    _dup_buffer = new char[DUP_SIZE];
+    if (! _dup_buffer)
+      return false;
+  }
+  _dup_start = 0;
+  _dup_length = 0;
+  _dup_line_pos = 0;
+  _dup_line_len = 0;
+  _total = 0;
+  _build = crc32(md5.c_str(), md5.length());
   clear();
   return true;
 }
 
-template<const uint16_t MAX_SIZE>
-void Logger<MAX_SIZE>::clear() {
-  *_buffer = '\0';
+template<const uint16_t MAX_SIZE, const uint16_t DUP_SIZE>
+void Logger<MAX_SIZE, DUP_SIZE>::clear() {
+  _start = 0;
   _length = 0;
 }
 
-template<const uint16_t MAX_SIZE>
-inline uint16_t Logger<MAX_SIZE>::length() const {
+template<const uint16_t MAX_SIZE, const uint16_t DUP_SIZE>
+inline uint16_t Logger<MAX_SIZE, DUP_SIZE>::length() const {
   return _length;
 }
 
-template<const uint16_t MAX_SIZE>
-inline Logger<MAX_SIZE>::operator const char* () {
-  return _buffer;
+template<const uint16_t MAX_SIZE, const uint16_t DUP_SIZE>
+template<typename F>
+void Logger<MAX_SIZE, DUP_SIZE>::forEach(F callback, uint32_t since, uint32_t until) const { // callback(const char *data, uint16_t len) gets text spans (in place) and formatted events
+  uint16_t offset = 0;
+  uint16_t end = _length;
+
+  if ((int32_t)(since - (_total - _length)) > 0) // Skip records stored before position()
+    offset = _min(since - (_total - _length), (uint32_t)_length);
+  if (until && ((int32_t)(_total - until) > 0)) // Skip records stored after until
+    end = _length - _min(_total - until, (uint32_t)_length);
+
+  while (offset < end) {
+    uint16_t pos = (_start + offset) % MAX_SIZE;
+
+    if (_buffer[pos] == EVENT_MARKER) {
+      char str[MAX_EVENT_LENGTH];
+
+      callback((const char*)str, (uint16_t)formatEvent(_buffer, MAX_SIZE, _start, offset, str));
+      offset += eventSize(_buffer, MAX_SIZE, _start, offset);
+    } else {
+      uint16_t len = _min((uint16_t)(end - offset), (uint16_t)(MAX_SIZE - pos));
+      const char *marker = (const char*)memchr(&_buffer[pos], EVENT_MARKER, len);
+
+      if (marker)
+        len = marker - &_buffer[pos];
+      callback((const char*)&_buffer[pos], len);
+      offset += len;
+    }
+  }
+}
+
+template<const uint16_t MAX_SIZE, const uint16_t DUP_SIZE>
+uint32_t Logger<MAX_SIZE, DUP_SIZE>::next(uint32_t since) const { // After oldest record if since is already evicted
+  uint16_t offset = 0;
+
+  if ((int32_t)(since - (_total - _length)) > 0)
+    offset = _min(since - (_total - _length), (uint32_t)_length);
+  if (offset < _length)
+    offset = nextRecord(offset);
+  return _total - _length + offset;
+}
+
+template<const uint16_t MAX_SIZE, const uint16_t DUP_SIZE>
+void Logger<MAX_SIZE, DUP_SIZE>::ringPut(char *ring, uint16_t size, uint16_t start, uint16_t length, const char *data, uint16_t len) {
+  uint16_t end = (start + length) % size;
+  uint16_t chunk = _min(len, (uint16_t)(size - end));
+
+  memcpy(&ring[end], data, chunk);
+  if (chunk < len)
+    memcpy(ring, &data[chunk], len - chunk);
+}
+
+template<const uint16_t MAX_SIZE, const uint16_t DUP_SIZE>
+void Logger<MAX_SIZE, DUP_SIZE>::ringGet(const char *ring, uint16_t size, uint16_t start, uint16_t offset, void *data, uint16_t len) {
+  uint16_t pos = (start + offset) % size;
+  uint16_t chunk = _min(len, (uint16_t)(size - pos));
+
+  memcpy(data, &ring[pos], chunk);
+  if (chunk < len)
+    memcpy(&((uint8_t*)data)[chunk], ring, len - chunk);
+}
+
+template<const uint16_t MAX_SIZE, const uint16_t DUP_SIZE>
+uint8_t Logger<MAX_SIZE, DUP_SIZE>::eventSize(const char *ring, uint16_t size, uint16_t start, uint16_t offset) {
+  uint8_t argc;
+
+  ringGet(ring, size, start, offset + offsetof(event_t, argc), &argc, sizeof(argc));
+  return EVENT_HEADER + argc * sizeof(uint32_t);
+}
+
+template<const uint16_t MAX_SIZE, const uint16_t DUP_SIZE>
+uint8_t Logger<MAX_SIZE, DUP_SIZE>::formatEvent(const char *ring, uint16_t size, uint16_t start, uint16_t offset, char *str) {
+  event_t event;
+  int len;
+
+  memset(&event, 0, sizeof(event));
+  ringGet(ring, size, start, offset, &event, eventSize(ring, size, start, offset));
+  len = snprintf_P(str, MAX_EVENT_LENGTH, PSTR("[%u.%03u] "), event.time / 1000, event.time % 1000);
+  len += snprintf_P(&str[len], MAX_EVENT_LENGTH - len, event.fmt, event.argv[0], event.argv[1], event.argv[2], event.argv[3]);
+  if (len > MAX_EVENT_LENGTH - 2)
+    len = MAX_EVENT_LENGTH - 2;
+  str[len++] = '\n';
+  return len;
+}
+
+template<const uint16_t MAX_SIZE, const uint16_t DUP_SIZE>
+uint16_t Logger<MAX_SIZE, DUP_SIZE>::nextRecord(uint16_t offset) const { // Offset after the event or text line (up to next event) at offset
+  if (_buffer[(_start + offset) % MAX_SIZE] == EVENT_MARKER)
+    return offset + eventSize(_buffer, MAX_SIZE, _start, offset);
+  while (offset < _length) {
+    char c = _buffer[(_start + offset) % MAX_SIZE];
+
+    if (c == EVENT_MARKER)
+      break;
+    ++offset;
+    if (c == '\n')
+      break;
+  }
+  return offset;
+}
+
+template<const uint16_t MAX_SIZE, const uint16_t DUP_SIZE>
+bool Logger<MAX_SIZE, DUP_SIZE>::rtcSave(uint8_t offset, uint16_t size) const { // offset in 4-byte blocks, size in bytes
+  rtc_log_t header;
+  uint16_t capacity = (size - sizeof(header)) & ~3;
+  uint16_t tail = 0;
+  uint8_t block = offset + sizeof(header) / 4;
+
+  if ((! _buffer) || (size <= sizeof(header)))
+    return false;
+  while (_length - tail > capacity) { // Whole records only
+    tail = nextRecord(tail);
+  }
+  header.build = _build;
+  header.length = _length - tail;
+  header.reserved = 0;
+  header.crc = crc32(&header, offsetof(rtc_log_t, crc));
+  for (uint16_t pos = 0; pos < header.length; pos += RTC_CHUNK) {
+    uint32_t chunk[RTC_CHUNK / 4];
+    uint8_t len = _min((uint16_t)RTC_CHUNK, (uint16_t)(header.length - pos));
+
+    ringGet(_buffer, MAX_SIZE, _start, tail + pos, chunk, len);
+    header.crc = crc32(chunk, len, header.crc);
+    if (! ESP.rtcUserMemoryWrite(block, chunk, (len + 3) & ~3))
+      return false;
+    block += RTC_CHUNK / 4;
+  }
+  return ESP.rtcUserMemoryWrite(offset, (uint32_t*)&header, sizeof(header));
+}
+
+template<const uint16_t MAX_SIZE, const uint16_t DUP_SIZE>
+bool Logger<MAX_SIZE, DUP_SIZE>::rtcRestore(uint8_t offset, uint16_t size) {
+  rtc_log_t header;
+  uint32_t *data;
+  uint32_t crc;
+  bool result = false;
+
+  if ((! ESP.rtcUserMemoryRead(offset, (uint32_t*)&header, sizeof(header))) || (! header.length) || (header.length > ((size - sizeof(header)) & ~3)))
+    return false;
+  data = new uint32_t[(header.length + 3) / 4];
+  if (! data)
+    return false;
+  if (ESP.rtcUserMemoryRead(offset + sizeof(header) / 4, data, (header.length + 3) & ~3)) {
+    crc = crc32(&header, offsetof(rtc_log_t, crc));
+    if (crc32(data, header.length, crc) == header.crc) {
+      const char *ring = (const char*)data;
+      bool events = header.build == _build;
+      uint16_t pos = 0;
+
+      while (pos < header.length) {
+        if (ring[pos] == EVENT_MARKER) {
+          if ((header.length - pos < EVENT_HEADER) || ((uint8_t)ring[pos + offsetof(event_t, argc)] > MAX_ARGS) ||
+            (header.length - pos < eventSize(ring, header.length, 0, pos)))
+            break;
+          if (events) {
+            char str[MAX_EVENT_LENGTH];
+
+            write((const uint8_t*)str, formatEvent(ring, header.length, 0, pos, str));
+          }
+          pos += eventSize(ring, header.length, 0, pos);
+        } else {
+          const char *marker = (const char*)memchr(&ring[pos], EVENT_MARKER, header.length - pos);
+          uint16_t len = marker ? marker - &ring[pos] : header.length - pos;
+
+          write((const uint8_t*)&ring[pos], len);
+          pos += len;
+        }
+      }
+      result = true;
+    }
+  }
+  delete[] data;
+  return result;
+}
+
+template<const uint16_t MAX_SIZE, const uint16_t DUP_SIZE>
+void Logger<MAX_SIZE, DUP_SIZE>::evict() { // Drop oldest line or event (or half of buffer if line is too long)
+  uint16_t len = 0;
+
+  if (! _length)
+    return;
+  if (_buffer[_start] == EVENT_MARKER) {
+    len = _min((uint16_t)eventSize(_buffer, MAX_SIZE, _start, 0), _length);
+  } else {
+    while ((len < MAX_SIZE / 2) && (len < _length)) {
+      char c = _buffer[(_start + len) % MAX_SIZE];
+
+      if (c == EVENT_MARKER)
+        break;
+      ++len;
+      if (c == '\n')
+        break;
+    }
+  }
+  _start = (_start + len) % MAX_SIZE;
+  _length -= len;
+}
+
+template<const uint16_t MAX_SIZE, const uint16_t DUP_SIZE>
+void Logger<MAX_SIZE, DUP_SIZE>::put(const char *data, uint16_t size) {
+  if (size > MAX_SIZE) { // Only tail of text fits
+    data += size - MAX_SIZE;
+    size = MAX_SIZE;
+  }
+  while (MAX_SIZE - _length < size) {
+    evict();
+  }
+  ringPut(_buffer, MAX_SIZE, _start, _length, data, size);
+  _length += size;
+  _total += size;
+}
+
+template<const uint16_t MAX_SIZE, const uint16_t DUP_SIZE>
+void Logger<MAX_SIZE, DUP_SIZE>::dupPut(const char *data, uint16_t size) {
+  bool idle = ! pending();
+
+  if (idle && (*data != EVENT_MARKER)) { // Bypass queue while output is idle
+    int avail = _dup->availableForWrite();
+
+    if (avail > 0) {
+      avail = _dup->write((const uint8_t*)data, _min((uint16_t)avail, size));
+      data += avail;
+      size -= avail;
+    }
+  }
+  if (size) {
+    if (size > DUP_SIZE - _dup_length) { // Queue overflow, events are never truncated
+      _dup_dropped += size;
+      return;
+    }
+    ringPut(_dup_buffer, DUP_SIZE, _dup_start, _dup_length, data, size);
+    _dup_length += size;
+    if (idle && _onqueued)
+      _onqueued();
+  }
+}
+
+template<const uint16_t MAX_SIZE, const uint16_t DUP_SIZE>
+void Logger<MAX_SIZE, DUP_SIZE>::loop() { // Send as much queued data as output accepts without waiting
+  while (true) {
+    int avail;
+
+    if (_dup_line_pos >= _dup_line_len) {
+      if (! _dup_length)
+        break;
+      if (_dup_buffer[_dup_start] == EVENT_MARKER) {
+        uint8_t size = eventSize(_dup_buffer, DUP_SIZE, _dup_start, 0);
+
+        _dup_line_len = formatEvent(_dup_buffer, DUP_SIZE, _dup_start, 0, _dup_line);
+        _dup_line_pos = 0;
+        _dup_start = (_dup_start + size) % DUP_SIZE;
+        _dup_length -= size;
+      }
+    }
+    if ((avail = _dup->availableForWrite()) <= 0)
+      break;
+    if (_dup_line_pos < _dup_line_len) {
+      _dup_line_pos += _dup->write((const uint8_t*)&_dup_line[_dup_line_pos], _min((uint8_t)avail, (uint8_t)(_dup_line_len - _dup_line_pos)));
+    } else {
+      uint16_t chunk = _min((uint16_t)avail, (uint16_t)_min(_dup_length, DUP_SIZE - _dup_start));
+      const char *marker = (const char*)memchr(&_dup_buffer[_dup_start], EVENT_MARKER, chunk);
+
+      if (marker)
+        chunk = marker - &_dup_buffer[_dup_start];
+      chunk = _dup->write((const uint8_t*)&_dup_buffer[_dup_start], chunk);
+      if (! chunk)
+        break;
+      _dup_start = (_dup_start + chunk) % DUP_SIZE;
+      _dup_length -= chunk;
+    }
+  }
+}
+
+template<const uint16_t MAX_SIZE, const uint16_t DUP_SIZE>
+void Logger<MAX_SIZE, DUP_SIZE>::flush() {
+  if (_dup && _dup_buffer) {
+    while (pending()) {
+      loop();
+      _dup->flush(); // Wait for output
+    }
+  }
+}
+
+template<const uint16_t MAX_SIZE, const uint16_t DUP_SIZE>
+size_t Logger<MAX_SIZE, DUP_SIZE>::write(uint8_t val) {
+  return write(&val, sizeof(val));
 }
 
-template<const uint16_t MAX_SIZE>
-size_t Logger<MAX_SIZE>::write(uint8_t val) {
-  if (val != '\r') {
-    if (_length >= MAX_SIZE - 1) {
-      uint16_t start = 0;
+template<const uint16_t MAX_SIZE, const uint16_t DUP_SIZE>
+size_t Logger<MAX_SIZE, DUP_SIZE>::write(const uint8_t *buffer, size_t size) {
+  const char *data = (const char*)buffer;
+  size_t len = size;
+
+  while (len) {
+    size_t span = 0;
 
-      while ((start < MAX_SIZE / 2) && (_buffer[start] != '\n')) // Find EOL
-        ++start;
-      ++start; // Skip '\n'
-      _length -= start;
-      memmove(_buffer, &_buffer[start], _length);
+    while ((span < len) && (span < MAX_SIZE) && (data[span] != '\r') && (data[span] != EVENT_MARKER)) // Longer text goes in pieces
+      ++span;
+    if (span) {
+      put(data, span);
+      if (_dup && _dup_buffer)
+        dupPut(data, span);
     }
-    _buffer[_length++] = val;
-    _buffer[_length] = '\0';
+    if ((span < len) && ((data[span] == '\r') || (data[span] == EVENT_MARKER)))
+      ++span; // Skip '\r' and marker
+    data += span;
+    len -= span;
   }
-  if (_dup)
-    _dup->write(val);
-  return sizeof(val);
+  return size;
+}
+
+template<const uint16_t MAX_SIZE, const uint16_t DUP_SIZE>
+template<typename... Args>
+void Logger<MAX_SIZE, DUP_SIZE>::event_P(PGM_P fmt, Args... args) {
+  static_assert(sizeof...(args) <= MAX_ARGS, "Too many event arguments");
+
+  event_t event;
+  uint32_t argv[sizeof...(args) + 1] = { (uint32_t)args... };
+  uint8_t size = EVENT_HEADER + sizeof...(args) * sizeof(uint32_t);
+
+  event.marker = EVENT_MARKER;
+  event.fmt = fmt;
+  event.time = millis();
+  event.argc = sizeof...(args);
+  memcpy(event.argv, argv, sizeof...(args) * sizeof(uint32_t));
+  put((const char*)&event, size);
+  if (_dup && _dup_buffer)
+    dupPut((const char*)&event, size);
 }
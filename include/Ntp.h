@@ -3,6 +3,13 @@
 #include <IPAddress.h>
 
 uint32_t ntpTime();
+uint16_t ntpFraction();
+uint32_t ntpError();
+void ntpSave(uint8_t rtc_offset);
+bool ntpRestore(uint8_t rtc_offset, uint32_t period);
+bool ntpRequest(const IPAddress &ntp_server);
+bool ntpRequest(const char *ntp_server);
+int8_t ntpCheck(int8_t tz, uint32_t timeout = 1000);
 bool ntpUpdate(const IPAddress &ntp_server, int8_t tz, uint32_t timeout = 1000, uint8_t repeat = 1);
 bool ntpUpdate(const char *ntp_server, int8_t tz, uint32_t timeout = 1000, uint8_t repeat = 1);
 bool ntpUpdate_P(PGM_P ntp_server, int8_t tz, uint32_t timeout = 1000, uint8_t repeat = 1);
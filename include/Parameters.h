@@ -2,95 +2,534 @@
 
 #include <functional>
 #include <EEPROM.h>
+#include <FS.h>
+#include <LittleFS.h>
+#include "Crc16.h"
+
+/*
+ * Parameters are kept in RAM and stored as append-only journal file:
+ * every store() appends one record with changed ranges only (record CRC makes it atomic),
+ * loop() compacts journal to a single full record (via temporary file and rename) when it grows too big.
+ * Parameters stored in EEPROM by older firmware are imported once.
+ *
+ * Journal starts with schema record (version and field descriptors of the writer),
+ * journal of other layout is loaded into temporary buffer and migrated field by field (matched by id).
+ */
+enum paramtype_t : uint8_t { FIELD_STR, FIELD_INT, FIELD_UINT };
+
+struct __attribute__((__packed__)) param_field_t {
+  uint8_t id; // Persistent, never reuse for other field
+  uint8_t type; // paramtype_t
+  uint16_t offset;
+  uint16_t size;
+};
+
+#define PARAM_FIELD(id, ftype, type, field) { id, ftype, offsetof(type, field), sizeof(type::field) }
 
 template<typename T>
 class Parameters {
 public:
   typedef std::function<void(T*)> clearcb_t;
 
-  Parameters() : _onclear(nullptr) {}
+  Parameters(const param_field_t *fields, uint8_t count, uint16_t version, FS &fs = LittleFS, const char *path = "/.config.jnl") : _fs(fs), _path(path),
+    _fields(fields), _count(count), _version(version), _onclear(nullptr), _dirty(0), _journal(0), _compact(false) {}
 
   void begin();
   bool check() const;
   operator bool() const {
     return check();
   }
-  T* operator ->() {
-    return ptr();
+  const T* operator ->() const {
+    return &_data;
+  }
+  template<typename F, typename V>
+  void set(F T::*field, V value) { // e.g. config.set(&config_t::ntp_tz, 3)
+    F _value = value;
+    uint16_t offset = (uint8_t*)&(ptr()->*field) - (uint8_t*)ptr();
+
+    if (memcmp((uint8_t*)ptr() + offset, &_value, sizeof(F))) {
+      memcpy((uint8_t*)ptr() + offset, &_value, sizeof(F)); // Field may be unaligned in packed struct
+      modified(offset, sizeof(F));
+    }
+  }
+  template<const size_t N>
+  void set(char (T::*field)[N], const char *str) {
+    if (strncmp(ptr()->*field, str, N - 1)) {
+      strlcpy(ptr()->*field, str, N);
+      modified((uint8_t*)(ptr()->*field) - (uint8_t*)ptr(), N);
+    }
+  }
+  void set(const T &data); // Whole parameters, only changed blocks are marked
+  void modified(uint16_t offset, uint16_t size);
+  uint16_t version() const {
+    return _version;
+  }
+  uint16_t storedVersion() const {
+    return _stored_version;
+  }
+  bool migrated() const {
+    return _migrated;
+  }
+  uint32_t loadTime() const { // in us.
+    return _load_time;
   }
   bool import(const uint8_t *data);
+  bool import(const uint8_t *data, uint16_t size); // Versioned (journal format)
+  bool exportTo(Print &out) { // Versioned (journal format)
+    return appendSchema(out) && append(out, true);
+  }
   bool store();
   void onClear(clearcb_t cb) {
     _onclear = cb;
   }
   void clear();
+  void loop();
 
 protected:
-  static const uint16_t SIGN = 0xA3C5;
+  static const uint16_t SIGN = 0xA3C5; // Legacy EEPROM signature
+  static const uint16_t RECORD_SIGN = 0x4A43;
+  static const uint16_t SCHEMA_SIGN = 0x5343;
+  static const uint16_t MAX_RECORD = 1024;
+  static const uint16_t JOURNAL_SIZE = 4096; // Compact when exceeds
+  static const uint8_t CRC_CHUNK = 32; // Granularity of cached CRC
+  static const uint8_t CRC_CHUNKS = (sizeof(T) + CRC_CHUNK - 1) / CRC_CHUNK;
+  static const uint8_t CHANGE_BLOCK = 8; // Granularity of journal records
+  static const uint8_t CHANGE_BLOCKS = (sizeof(T) + CHANGE_BLOCK - 1) / CHANGE_BLOCK;
+  static const uint8_t CLEAN = 0xFF;
+
+  struct __attribute__((__packed__)) record_t {
+    uint16_t sign;
+    uint16_t size; // Payload
+    uint16_t crc; // Payload
+    uint16_t data_crc; // Whole parameters after record is applied
+  };
+
+  struct __attribute__((__packed__)) range_t { // Payload is a list of ranges followed by data
+    uint16_t offset;
+    uint16_t size;
+  };
 
   T *ptr() {
-    return (T*)&EEPROM.getDataPtr()[4];
+    return &_data;
+  }
+  uint16_t crc() const;
+  bool changed(uint8_t block) const {
+    return _changed[block / 8] & (1 << (block % 8));
   }
+  bool nextRange(uint8_t *block, range_t *range) const;
+  bool sameSchema(uint16_t version, uint8_t count, const uint8_t *fields) const;
+  template<typename R>
+  bool parse(R read, bool apply, uint16_t *parsed);
+  void migrate(const param_field_t *fields, uint8_t count, const uint8_t *data);
+  bool load();
+  bool loadEeprom();
+  bool appendSchema(Print &out);
+  bool append(Print &out, bool full);
+  bool compact();
 
+  FS &_fs;
+  const char *_path; // Hidden (dot) name, web server does not serve it
+  const param_field_t *_fields; // PROGMEM
+  uint8_t _count;
+  uint16_t _version;
+  uint16_t _stored_version;
+  bool _migrated;
+  uint32_t _load_time;
   clearcb_t _onclear;
+  T _data;
+  uint16_t _stored; // CRC of stored parameters
+  mutable uint16_t _crcs[CRC_CHUNKS]; // CRC up to the end of each chunk
+  mutable uint8_t _dirty; // First chunk to recalculate or CLEAN
+  mutable bool _valid;
+  uint8_t _changed[(CHANGE_BLOCKS + 7) / 8]; // Blocks changed since last store()
+  uint16_t _journal; // Journal file size
+  bool _compact;
 };
 
-static uint16_t crc16(uint8_t value, uint16_t crc = 0xFFFF) {
-  crc ^= value;
-  for (uint8_t i = 0; i < 8; ++i) {
-    if (crc & 0x01)
-      crc = (crc >> 1) ^ 0xA001;
-    else
-      crc >>= 1;
-  }
-  return crc;
-}
-
-static uint16_t crc16(const uint8_t *data, uint16_t size, uint16_t crc = 0xFFFF) {
-  while (size--) {
-    crc = crc16(*data++, crc);
-  }
-  return crc;
-}
-
 template<typename T>
 void Parameters<T>::begin() {
-  EEPROM.begin(sizeof(T) + 4);
+  memset(&_data, 0, sizeof(T));
+  memset(_changed, 0, sizeof(_changed));
+  _stored = ~crc16((const uint8_t*)&_data, sizeof(T)); // Never matches until loaded or stored
+  _dirty = 0;
+  _valid = false;
+  _stored_version = _version;
+  _migrated = false;
+  _load_time = micros();
+  if ((! load()) && loadEeprom())
+    _compact = true; // Move to journal
+  _load_time = micros() - _load_time;
   if (! check())
     clear();
 }
 
 template<typename T>
 bool Parameters<T>::import(const uint8_t *data) {
-  uint8_t *_data = EEPROM.getDataPtr();
+  memcpy_P(ptr(), data, sizeof(T));
+  modified(0, sizeof(T));
+  return store();
+}
+
+template<typename T>
+bool Parameters<T>::import(const uint8_t *data, uint16_t size) {
+  uint16_t pos = 0;
+  uint16_t parsed;
+  auto reader = [&](void *buf, uint16_t len) {
+    if (pos + len > size)
+      return false;
+    memcpy_P(buf, &data[pos], len);
+    pos += len;
+    return true;
+  };
 
-  memcpy_P(&_data[4], data, sizeof(T));
-  *(uint16_t*)&_data[0] = SIGN;
-  *(uint16_t*)&_data[2] = crc16(&_data[4], sizeof(T));
-  return EEPROM.commit();
+  if ((! parse(reader, false, &parsed)) || (parsed != size)) // Validate whole blob first
+    return false;
+  pos = 0;
+  parse(reader, true, &parsed);
+  _compact = true; // Rewrite journal
+  return store();
 }
 
 template<typename T>
 bool Parameters<T>::store() {
-  uint8_t *data = EEPROM.getDataPtr();
+  bool result = false;
+
+  if (_compact || (! _journal) || (_journal > JOURNAL_SIZE)) {
+    result = compact();
+  } else {
+    File file = _fs.open(_path, "a");
 
-  *(uint16_t*)&data[0] = SIGN;
-  *(uint16_t*)&data[2] = crc16(&data[4], sizeof(T));
-  return EEPROM.commit();
+    if (file) {
+      result = append(file, false);
+      _journal = file.size();
+      file.close();
+      if (_journal > JOURNAL_SIZE)
+        _compact = true; // Postpone to loop()
+    }
+  }
+  if (result) {
+    _stored = crc();
+    _valid = true;
+    memset(_changed, 0, sizeof(_changed));
+  }
+  return result;
 }
 
 template<typename T>
 void Parameters<T>::clear() {
-  uint8_t *data = EEPROM.getDataPtr();
-
-  memset(&data[4], 0, sizeof(T));
+  memset(ptr(), 0, sizeof(T));
   if (_onclear)
-    _onclear((T*)&data[4]);
+    _onclear(ptr());
+  modified(0, sizeof(T));
+}
+
+template<typename T>
+void Parameters<T>::loop() {
+  if (_compact && check()) // Only stored state
+    compact();
+}
+
+template<typename T>
+void Parameters<T>::set(const T &data) {
+  for (uint16_t offset = 0; offset < sizeof(T); offset += CHANGE_BLOCK) {
+    uint16_t size = _min(sizeof(T) - offset, (size_t)CHANGE_BLOCK);
+
+    if (memcmp((uint8_t*)ptr() + offset, (const uint8_t*)&data + offset, size)) {
+      memcpy((uint8_t*)ptr() + offset, (const uint8_t*)&data + offset, size);
+      modified(offset, size);
+    }
+  }
+}
+
+template<typename T>
+void Parameters<T>::modified(uint16_t offset, uint16_t size) {
+  if (size && (offset < sizeof(T))) {
+    if ((_dirty == CLEAN) || (offset / CRC_CHUNK < _dirty))
+      _dirty = offset / CRC_CHUNK;
+    if (offset + size > sizeof(T))
+      size = sizeof(T) - offset;
+    for (uint8_t i = offset / CHANGE_BLOCK; i <= (offset + size - 1) / CHANGE_BLOCK; ++i) {
+      _changed[i / 8] |= 1 << (i % 8);
+    }
+  }
+}
+
+template<typename T>
+uint16_t Parameters<T>::crc() const { // Recalculate from first modified chunk only
+  if (_dirty != CLEAN) {
+    const uint8_t *data = (const uint8_t*)&_data;
+    uint16_t crc = _dirty ? _crcs[_dirty - 1] : 0xFFFF;
+
+    for (uint8_t i = _dirty; i < CRC_CHUNKS; ++i) {
+      crc = crc16(&data[i * CRC_CHUNK], _min(sizeof(T) - i * CRC_CHUNK, (size_t)CRC_CHUNK), crc);
+      _crcs[i] = crc;
+    }
+    _dirty = CLEAN;
+  }
+  return _crcs[CRC_CHUNKS - 1];
 }
 
 template<typename T>
 bool Parameters<T>::check() const {
-  const uint8_t *data = EEPROM.getConstDataPtr();
+  if ((_dirty != CLEAN) || (! _valid))
+    _valid = crc() == _stored;
+  return _valid;
+}
 
-  return (*(uint16_t*)&data[0] == SIGN) && (crc16(&data[4], sizeof(T)) == *(uint16_t*)&data[2]);
+template<typename T>
+bool Parameters<T>::nextRange(uint8_t *block, range_t *range) const { // Next run of changed blocks starting from *block
+  while ((*block < CHANGE_BLOCKS) && (! changed(*block)))
+    ++*block;
+  if (*block >= CHANGE_BLOCKS)
+    return false;
+  range->offset = *block * CHANGE_BLOCK;
+  while ((*block < CHANGE_BLOCKS) && changed(*block))
+    ++*block;
+  range->size = _min((size_t)(*block * CHANGE_BLOCK), sizeof(T)) - range->offset;
+  return true;
+}
+
+template<typename T>
+bool Parameters<T>::sameSchema(uint16_t version, uint8_t count, const uint8_t *fields) const {
+  return (version == _version) && (count == _count) && (! memcmp_P(fields, _fields, count * sizeof(param_field_t)));
+}
+
+template<typename T>
+bool Parameters<T>::appendSchema(Print &out) {
+  record_t record;
+  param_field_t field;
+
+  record.sign = SCHEMA_SIGN;
+  record.size = sizeof(_version) + sizeof(_count) + _count * sizeof(param_field_t);
+  record.crc = crc16((const uint8_t*)&_version, sizeof(_version));
+  record.crc = crc16((const uint8_t*)&_count, sizeof(_count), record.crc);
+  for (uint8_t i = 0; i < _count; ++i) {
+    memcpy_P(&field, &_fields[i], sizeof(field));
+    record.crc = crc16((const uint8_t*)&field, sizeof(field), record.crc);
+  }
+  record.data_crc = 0;
+  if ((out.write((const uint8_t*)&record, sizeof(record)) != sizeof(record)) ||
+    (out.write((const uint8_t*)&_version, sizeof(_version)) != sizeof(_version)) || (out.write(&_count, sizeof(_count)) != sizeof(_count)))
+    return false;
+  for (uint8_t i = 0; i < _count; ++i) {
+    memcpy_P(&field, &_fields[i], sizeof(field));
+    if (out.write((const uint8_t*)&field, sizeof(field)) != sizeof(field))
+      return false;
+  }
+  return true;
+}
+
+template<typename T>
+bool Parameters<T>::append(Print &out, bool full) {
+  const uint8_t *data = (const uint8_t*)&_data;
+  record_t record;
+  range_t range;
+  uint8_t block;
+
+  record.sign = RECORD_SIGN;
+  record.size = 0;
+  record.crc = 0xFFFF;
+  record.data_crc = crc();
+  if (full) {
+    range.offset = 0;
+    range.size = sizeof(T);
+    record.size = sizeof(range) + sizeof(T);
+    record.crc = crc16((const uint8_t*)&range, sizeof(range), record.crc);
+    record.crc = crc16(data, sizeof(T), record.crc);
+  } else {
+    for (block = 0; nextRange(&block, &range); ) {
+      record.size += sizeof(range) + range.size;
+      record.crc = crc16((const uint8_t*)&range, sizeof(range), record.crc);
+      record.crc = crc16(&data[range.offset], range.size, record.crc);
+    }
+    if (! record.size) // Nothing changed
+      return true;
+  }
+  if (out.write((const uint8_t*)&record, sizeof(record)) != sizeof(record))
+    return false;
+  if (full) {
+    if ((out.write((const uint8_t*)&range, sizeof(range)) != sizeof(range)) || (out.write(data, sizeof(T)) != sizeof(T)))
+      return false;
+  } else {
+    for (block = 0; nextRange(&block, &range); ) {
+      if ((out.write((const uint8_t*)&range, sizeof(range)) != sizeof(range)) || (out.write(&data[range.offset], range.size) != range.size))
+        return false;
+    }
+  }
+  return true;
+}
+
+template<typename T>
+template<typename R>
+bool Parameters<T>::parse(R read, bool apply, uint16_t *parsed) { // Apply all complete records, read(void *buf, uint16_t len) returns false at the end
+  uint8_t *payload = new uint8_t[MAX_RECORD];
+  param_field_t *fields = nullptr; // Other layout
+  uint8_t *data = apply ? (uint8_t*)&_data : nullptr;
+  uint16_t size = sizeof(T);
+  uint16_t version = _version;
+  uint16_t stored = 0;
+  uint8_t count = 0;
+  record_t record;
+  bool result = false;
+
+  *parsed = 0;
+  if (! payload)
+    return false;
+  while (read(&record, sizeof(record))) {
+    if (((record.sign != RECORD_SIGN) && ((record.sign != SCHEMA_SIGN) || *parsed)) || (record.size > MAX_RECORD) ||
+      (! read(payload, record.size)) || (crc16(payload, record.size) != record.crc))
+      break; // Torn or corrupted tail
+    if (record.sign == SCHEMA_SIGN) {
+      if (record.size < sizeof(version) + sizeof(count))
+        break;
+      memcpy(&version, payload, sizeof(version));
+      count = payload[sizeof(version)];
+      if (record.size != sizeof(version) + sizeof(count) + count * sizeof(param_field_t))
+        break;
+      if (! sameSchema(version, count, &payload[sizeof(version) + sizeof(count)])) {
+        if (! (fields = new param_field_t[count]))
+          break;
+        memcpy(fields, &payload[sizeof(version) + sizeof(count)], count * sizeof(param_field_t));
+        size = 0;
+        for (uint8_t i = 0; i < count; ++i) {
+          if (fields[i].offset + fields[i].size > size)
+            size = fields[i].offset + fields[i].size;
+        }
+        if (apply) {
+          if (! (data = new uint8_t[size]))
+            break;
+          memset(data, 0, size);
+        }
+      }
+    } else { // Ranges of data
+      uint16_t pos = 0;
+
+      while (pos + sizeof(range_t) <= record.size) {
+        range_t range;
+
+        memcpy(&range, &payload[pos], sizeof(range));
+        pos += sizeof(range);
+        if ((range.offset + range.size > size) || (pos + range.size > record.size))
+          break;
+        if (data)
+          memcpy(&data[range.offset], &payload[pos], range.size);
+        pos += range.size;
+      }
+      stored = record.data_crc;
+      result = true;
+    }
+    *parsed += sizeof(record) + record.size;
+  }
+  delete[] payload;
+  if (result && apply) {
+    _stored_version = version;
+    if (fields) {
+      migrate(fields, count, data);
+      _stored = crc(); // Migrated data is valid, store in current layout
+      _compact = true;
+      _migrated = true;
+    } else {
+      _stored = stored;
+      _dirty = 0;
+    }
+  }
+  if (fields) {
+    delete[] fields;
+    if (data)
+      delete[] data;
+  }
+  return result;
+}
+
+template<typename T>
+void Parameters<T>::migrate(const param_field_t *fields, uint8_t count, const uint8_t *data) { // Defaults for new fields, converted values for known ones
+  clear();
+  for (uint8_t i = 0; i < _count; ++i) {
+    param_field_t field;
+
+    memcpy_P(&field, &_fields[i], sizeof(field));
+    for (uint8_t j = 0; j < count; ++j) {
+      if (fields[j].id == field.id) {
+        const uint8_t *src = &data[fields[j].offset];
+        uint8_t *dest = (uint8_t*)&_data + field.offset;
+
+        if (field.type == FIELD_STR) {
+          uint16_t len = strnlen((const char*)src, fields[j].size);
+
+          if (len > field.size - 1)
+            len = field.size - 1;
+          memcpy(dest, src, len);
+          memset(&dest[len], 0, field.size - len);
+        } else {
+          uint8_t len = _min(fields[j].size, (uint16_t)sizeof(int32_t));
+          int32_t value = 0;
+
+          memcpy(&value, src, len); // Little endian
+          if ((fields[j].type == FIELD_INT) && (len < sizeof(value)) && (value & (1L << (len * 8 - 1))))
+            value |= -1L << (len * 8); // Sign extension
+          memcpy(dest, &value, _min(field.size, (uint16_t)sizeof(value)));
+        }
+        break;
+      }
+    }
+  }
+}
+
+template<typename T>
+bool Parameters<T>::load() {
+  File file = _fs.open(_path, "r");
+  uint16_t parsed;
+  bool result;
+
+  _journal = 0;
+  if (! file)
+    return false;
+  result = parse([&file](void *buf, uint16_t len) {
+    return file.read((uint8_t*)buf, len) == len;
+  }, true, &parsed);
+  _journal = parsed;
+  if (_journal < file.size()) // Drop garbage at the end
+    _compact = true;
+  file.close();
+  return result;
+}
+
+template<typename T>
+bool Parameters<T>::loadEeprom() {
+  const uint8_t *data;
+  bool result;
+
+  EEPROM.begin(sizeof(T) + 4);
+  data = EEPROM.getConstDataPtr();
+  result = (*(uint16_t*)&data[0] == SIGN) && (crc16(&data[4], sizeof(T)) == *(uint16_t*)&data[2]);
+  if (result) {
+    memcpy(&_data, &data[4], sizeof(T));
+    _stored = *(uint16_t*)&data[2];
+    _dirty = 0;
+  }
+  EEPROM.end();
+  return result;
+}
+
+template<typename T>
+bool Parameters<T>::compact() { // Rewrite journal as single full record
+  char path[32];
+  File file;
+  bool result;
+
+  snprintf_P(path, sizeof(path), PSTR("%s.tmp"), _path);
+  if (! (file = _fs.open(path, "w")))
+    return false;
+  result = appendSchema(file) && append(file, true);
+  _journal = file.size();
+  file.close();
+  if (result)
+    result = _fs.rename(path, _path); // Atomic replace
+  if (! result) {
+    _fs.remove(path);
+  } else {
+    memset(_changed, 0, sizeof(_changed));
+    _compact = false;
+  }
+  return result;
 }
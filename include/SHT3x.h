@@ -3,134 +3,157 @@
 #include <math.h>
 #include <Wire.h>
 
-template<TwoWire &WIRE = Wire>
+/*
+ * Conversion is never waited on the bus: start() (single shot) or startPeriodic(),
+ * then poll() until conversion time is over and read() (returns 0 while sensor has no new data).
+ * measure() is blocking wrapper of single shot.
+ * Integer API returns hundredths of degree and percent (INVALID on CRC error), float API is kept for compatibility.
+ */
 class SHT3x {
 public:
-  static void init(int8_t sda, int8_t scl, bool fast = true);
-  static void init(bool fast = true);
+  enum repeat_t { REPEAT_LOW, REPEAT_MEDIUM, REPEAT_HIGH };
+  enum mps_t { MPS_05, MPS_1, MPS_2, MPS_4, MPS_10, MPS_NONE }; // Measurements per second
+
+  static const int16_t INVALID = -32768;
+
+  SHT3x(TwoWire &wire = Wire) : _wire(wire), _addr(0), _repeat(REPEAT_HIGH), _mps(MPS_NONE) {}
+
+  static void init(int8_t sda, int8_t scl, bool fast = true, TwoWire &wire = Wire);
+  static void init(bool fast = true, TwoWire &wire = Wire);
 
   bool begin(uint8_t addr = 0);
   bool reset();
   bool heater(bool on);
+  bool start(repeat_t repeat = REPEAT_HIGH);
+  bool startPeriodic(mps_t mps, repeat_t repeat = REPEAT_HIGH);
+  bool stop();
+  bool poll() const;
+  int8_t read(int16_t *temp, int16_t *hum);
+  int8_t read(float *temp, float *hum);
+  bool measure(int16_t *temp, int16_t *hum);
   bool measure(float *temp, float *hum);
   float getTemperature();
   float getHumidity();
+  uint8_t duration() const; // Conversion time (in ms.)
+  uint16_t period() const; // Periodic mode interval (in ms.)
+  TwoWire &wire() const {
+    return _wire;
+  }
+  uint8_t address() const {
+    return _addr;
+  }
 
 protected:
   static uint8_t crc8(uint16_t data);
+  static int16_t toTemperature(uint16_t data) {
+    return (((uint32_t)data * 17500 + 32768) >> 16) - 4500; // 175 * data / 65535 - 45 (in 0.01 C)
+  }
+  static int16_t toHumidity(uint16_t data) {
+    return ((uint32_t)data * 10000 + 32768) >> 16; // 100 * data / 65535 (in 0.01 %)
+  }
+
+  bool command(uint16_t cmd);
 
+  TwoWire &_wire;
   uint8_t _addr;
+  repeat_t _repeat : 2;
+  mps_t _mps : 3;
+  uint32_t _start;
 };
 
-template<TwoWire &WIRE>
-void SHT3x<WIRE>::init(int8_t sda, int8_t scl, bool fast) {
-  WIRE.begin(sda, scl);
-  if (fast)
-    WIRE.setClock(400000);
-}
-
-template<TwoWire &WIRE>
-void SHT3x<WIRE>::init(bool fast) {
-  WIRE.begin();
-  if (fast)
-    WIRE.setClock(400000);
-}
+/*
+ * Up to CAPACITY (8 at most) sensors on any buses and addresses, measured together: start() triggers single shot
+ * conversion on every sensor back to back and returns time to wait, then read() fetches all of them in one pass.
+ * Sensor not ready yet (e.g. read was late) stays pending for next read(), it is not an error.
+ */
+template<const uint8_t CAPACITY = 2>
+class SHT3xGroup {
+public:
+  SHT3xGroup() : _count(0), _pending(0) {}
+  ~SHT3xGroup() {
+    clear();
+  }
 
-template<TwoWire &WIRE>
-bool SHT3x<WIRE>::begin(uint8_t addr) {
-  if (! addr) { // Auto address (0x44 or 0x45)
-    _addr = 0x44;
-    if (reset())
-      return true;
-    _addr = 0x45;
-    return reset();
-  } else {
-    _addr = addr;
-    return reset();
+  void clear();
+  uint8_t count() const {
+    return _count;
   }
-}
+  int8_t add(TwoWire &wire, uint8_t addr); // Index of found sensor or -1
+  uint8_t scan(TwoWire &wire = Wire); // Add sensors on both addresses (0x44 and 0x45), returns number of found
+  SHT3x &operator[](uint8_t index) {
+    return *_sensors[index];
+  }
+  uint8_t start(SHT3x::repeat_t repeat = SHT3x::REPEAT_HIGH); // Returns max. conversion time (in ms.)
+  uint8_t read(int16_t *temps, int16_t *hums); // Reads pending sensors, returns number of not ready ones; failed ones are INVALID, others are untouched
 
-template<TwoWire &WIRE>
-bool SHT3x<WIRE>::reset() {
-  WIRE.beginTransmission(_addr);
-  WIRE.write(0x30);
-  WIRE.write(0xA2);
-  return (WIRE.endTransmission() == 0);
-}
+protected:
+  SHT3x *_sensors[CAPACITY];
+  uint8_t _count;
+  uint8_t _pending; // Bit per sensor with unread conversion
+};
 
-template<TwoWire &WIRE>
-bool SHT3x<WIRE>::heater(bool on) {
-  WIRE.beginTransmission(_addr);
-  WIRE.write(0x30);
-  if (on)
-    WIRE.write(0x6D);
-  else
-    WIRE.write(0x66);
-  return (WIRE.endTransmission() == 0);
+template<const uint8_t CAPACITY>
+void SHT3xGroup<CAPACITY>::clear() {
+  while (_count) {
+    delete _sensors[--_count];
+  }
 }
 
-template<TwoWire &WIRE>
-bool SHT3x<WIRE>::measure(float *temp, float *hum) {
-  uint16_t data;
-  bool error = false;
-
-  WIRE.beginTransmission(_addr);
-  WIRE.write(0x2C);
-  WIRE.write(0x06);
-  if (WIRE.endTransmission() != 0)
-    return false;
-  if (WIRE.requestFrom(_addr, (uint8_t)6) != 6)
-    return false;
-  data = (WIRE.read() << 8) | WIRE.read();
-  if (crc8(data) != WIRE.read())
-    error = true;
-  if (temp) {
-    if (error)
-      *temp = NAN;
-    else
-      *temp = 175 * (data / 65535.0) - 45;
-  }
-  data = (WIRE.read() << 8) | WIRE.read();
-  if (crc8(data) != WIRE.read())
-    error = true;
-  if (hum) {
-    if (error)
-      *hum = NAN;
-    else
-      *hum = 100 * (data / 65535.0);
+template<const uint8_t CAPACITY>
+int8_t SHT3xGroup<CAPACITY>::add(TwoWire &wire, uint8_t addr) {
+  if (_count < CAPACITY) {
+    SHT3x *sensor = new SHT3x(wire);
+
+    if (sensor->begin(addr)) {
+      _sensors[_count] = sensor;
+      return _count++;
+    }
+    delete sensor;
   }
-  return (! error);
+  return -1;
 }
 
-template<TwoWire &WIRE>
-float SHT3x<WIRE>::getTemperature() {
-  float result;
+template<const uint8_t CAPACITY>
+uint8_t SHT3xGroup<CAPACITY>::scan(TwoWire &wire) {
+  uint8_t result = 0;
 
-  if (! measure(&result, nullptr))
-    result = NAN;
+  if (add(wire, 0x44) >= 0)
+    ++result;
+  if (add(wire, 0x45) >= 0)
+    ++result;
   return result;
 }
 
-template<TwoWire &WIRE>
-float SHT3x<WIRE>::getHumidity() {
-  float result;
+template<const uint8_t CAPACITY>
+uint8_t SHT3xGroup<CAPACITY>::start(SHT3x::repeat_t repeat) {
+  uint8_t result = 0;
 
-  if (! measure(nullptr, &result))
-    result = NAN;
+  _pending = 0;
+  for (uint8_t i = 0; i < _count; ++i) {
+    if (_sensors[i]->start(repeat)) {
+      _pending |= 1 << i;
+      if (_sensors[i]->duration() > result)
+        result = _sensors[i]->duration();
+    }
+  }
   return result;
 }
 
-template<TwoWire &WIRE>
-uint8_t SHT3x<WIRE>::crc8(uint16_t data) {
-  uint8_t result = 0xFF;
-
-  for (int8_t i = 1; i >= 0; --i) {
-    result ^= data >> (8 * i);
-    for (uint8_t bit = 8; bit > 0; --bit) {
-      if (result & 0x80)
-        result = (result << 1) ^ 0x31;
-      else
-        result <<= 1;
+template<const uint8_t CAPACITY>
+uint8_t SHT3xGroup<CAPACITY>::read(int16_t *temps, int16_t *hums) {
+  uint8_t result = 0;
+
+  for (uint8_t i = 0; i < _count; ++i) {
+    if (_pending & (1 << i)) {
+      int8_t status = _sensors[i]->read(&temps[i], &hums[i]);
+
+      if (! status) { // NACK, conversion is not over
+        ++result;
+        continue;
+      }
+      if (status < 0)
+        temps[i] = hums[i] = SHT3x::INVALID;
+      _pending &= ~(1 << i);
     }
   }
   return result;
@@ -0,0 +1,282 @@
+#pragma once
+
+#include <Arduino.h>
+
+struct __attribute__((__packed__)) window_bucket_t {
+  int16_t min;
+  int16_t max;
+  int32_t sum;
+  uint16_t count; // Samples in bucket, 0 is empty
+};
+
+/*
+ * Sliding window of CAPACITY buckets (aggregated samples) with O(1) amortized min/max
+ * (monotonic deques of ring positions) and running sum for mean.
+ */
+template<const uint8_t CAPACITY>
+class SlidingWindow {
+public:
+  typedef window_bucket_t bucket_t;
+
+  SlidingWindow() {
+    clear();
+  }
+
+  void clear();
+  uint8_t count() const {
+    return _count;
+  }
+  void push(const bucket_t &bucket); // Evicts oldest bucket when full
+  void merge(bucket_t &bucket) const; // Combine whole window into bucket
+
+  static void add(bucket_t &bucket, int16_t value);
+  static void add(bucket_t &bucket, const bucket_t &other);
+
+protected:
+  uint8_t next(uint8_t pos) const {
+    return (pos + 1 < CAPACITY) ? pos + 1 : 0;
+  }
+  uint8_t at(uint8_t pos, uint8_t index) const { // index-th item after pos (ring wrap)
+    return (pos + index) % CAPACITY;
+  }
+
+  bucket_t _items[CAPACITY];
+  uint8_t _mins[CAPACITY]; // Ring positions with ascending minimums
+  uint8_t _maxs[CAPACITY]; // Ring positions with descending maximums
+  int32_t _sum;
+  uint32_t _samples;
+  uint8_t _head, _count;
+  uint8_t _minHead, _minCount;
+  uint8_t _maxHead, _maxCount;
+};
+
+template<const uint8_t CAPACITY>
+void SlidingWindow<CAPACITY>::clear() {
+  _sum = 0;
+  _samples = 0;
+  _head = _count = 0;
+  _minHead = _minCount = 0;
+  _maxHead = _maxCount = 0;
+}
+
+template<const uint8_t CAPACITY>
+void SlidingWindow<CAPACITY>::push(const bucket_t &bucket) {
+  uint8_t pos;
+
+  if (! bucket.count)
+    return;
+  if (_count == CAPACITY) { // Evict oldest
+    if (_minCount && (_mins[_minHead] == _head)) {
+      _minHead = next(_minHead);
+      --_minCount;
+    }
+    if (_maxCount && (_maxs[_maxHead] == _head)) {
+      _maxHead = next(_maxHead);
+      --_maxCount;
+    }
+    _sum -= _items[_head].sum;
+    _samples -= _items[_head].count;
+    _head = next(_head);
+    --_count;
+  }
+  pos = at(_head, _count++);
+  _items[pos] = bucket;
+  _sum += bucket.sum;
+  _samples += bucket.count;
+  while (_minCount && (_items[_mins[at(_minHead, _minCount - 1)]].min >= bucket.min))
+    --_minCount;
+  _mins[at(_minHead, _minCount++)] = pos;
+  while (_maxCount && (_items[_maxs[at(_maxHead, _maxCount - 1)]].max <= bucket.max))
+    --_maxCount;
+  _maxs[at(_maxHead, _maxCount++)] = pos;
+}
+
+template<const uint8_t CAPACITY>
+void SlidingWindow<CAPACITY>::merge(bucket_t &bucket) const {
+  if (_count) {
+    bucket_t total;
+
+    total.min = _items[_mins[_minHead]].min;
+    total.max = _items[_maxs[_maxHead]].max;
+    total.sum = _sum;
+    total.count = _samples > 0xFFFF ? 0xFFFF : _samples;
+    add(bucket, total);
+  }
+}
+
+template<const uint8_t CAPACITY>
+void SlidingWindow<CAPACITY>::add(bucket_t &bucket, int16_t value) {
+  if (bucket.count) {
+    if (value < bucket.min)
+      bucket.min = value;
+    if (value > bucket.max)
+      bucket.max = value;
+    bucket.sum += value;
+    ++bucket.count;
+  } else {
+    bucket.min = bucket.max = value;
+    bucket.sum = value;
+    bucket.count = 1;
+  }
+}
+
+template<const uint8_t CAPACITY>
+void SlidingWindow<CAPACITY>::add(bucket_t &bucket, const bucket_t &other) {
+  if (other.count) {
+    if (bucket.count) {
+      if (other.min < bucket.min)
+        bucket.min = other.min;
+      if (other.max > bucket.max)
+        bucket.max = other.max;
+      bucket.sum += other.sum;
+      bucket.count = ((uint32_t)bucket.count + other.count > 0xFFFF) ? 0xFFFF : bucket.count + other.count;
+    } else {
+      bucket = other;
+    }
+  }
+}
+
+/*
+ * Sensor readings filter: median of last MEDIAN samples rejects single spikes, exponential moving average
+ * (alpha = 1 / 2^EMA_SHIFT) smooths them. Median values feed rolling statistics over last minute
+ * (SAMPLES per minute), hour (by minutes) and day (by hours), hour and day include current unfinished bucket.
+ * All storage is static, values are integers (e.g. hundredths), INVALID when no samples yet.
+ */
+template<const uint8_t MEDIAN = 5, const uint8_t SAMPLES = 30, const uint8_t EMA_SHIFT = 2>
+class SensorFilter {
+public:
+  enum window_t { WINDOW_MINUTE, WINDOW_HOUR, WINDOW_DAY };
+
+  static const int16_t INVALID = -32768;
+
+  SensorFilter() {
+    clear();
+  }
+
+  void clear();
+  int16_t add(int16_t value); // Returns filtered value
+  int16_t value() const { // Filtered (EMA of median)
+    return _median ? (_ema + (1 << (EMA_SHIFT - 1))) >> EMA_SHIFT : INVALID;
+  }
+  int16_t median() const;
+  int16_t min(window_t window) const;
+  int16_t max(window_t window) const;
+  int16_t mean(window_t window) const;
+
+protected:
+  typedef window_bucket_t bucket_t;
+
+  bucket_t stats(window_t window) const;
+
+  SlidingWindow<SAMPLES> _minute; // Last SAMPLES samples
+  SlidingWindow<60> _hour; // Last 60 minutes
+  SlidingWindow<24> _day; // Last 24 hours
+  bucket_t _curMinute, _curHour;
+  int32_t _ema; // Scaled by 2^EMA_SHIFT
+  int16_t _samples[MEDIAN];
+  uint8_t _pos, _median; // Ring position and fill of median samples
+};
+
+template<const uint8_t MEDIAN, const uint8_t SAMPLES, const uint8_t EMA_SHIFT>
+void SensorFilter<MEDIAN, SAMPLES, EMA_SHIFT>::clear() {
+  _minute.clear();
+  _hour.clear();
+  _day.clear();
+  _curMinute.count = 0;
+  _curHour.count = 0;
+  _ema = 0;
+  _pos = _median = 0;
+}
+
+template<const uint8_t MEDIAN, const uint8_t SAMPLES, const uint8_t EMA_SHIFT>
+int16_t SensorFilter<MEDIAN, SAMPLES, EMA_SHIFT>::add(int16_t value) {
+  bucket_t sample;
+
+  if (value == INVALID)
+    return this->value();
+  _samples[_pos] = value;
+  if (++_pos >= MEDIAN)
+    _pos = 0;
+  if (_median < MEDIAN)
+    ++_median;
+  value = median();
+  if (_median > 1)
+    _ema += value - ((_ema + (1 << (EMA_SHIFT - 1))) >> EMA_SHIFT);
+  else
+    _ema = (int32_t)value << EMA_SHIFT;
+
+  sample.count = 0;
+  SlidingWindow<SAMPLES>::add(sample, value);
+  _minute.push(sample);
+  SlidingWindow<SAMPLES>::add(_curMinute, sample);
+  if (_curMinute.count >= SAMPLES) {
+    _hour.push(_curMinute);
+    SlidingWindow<SAMPLES>::add(_curHour, _curMinute);
+    _curMinute.count = 0;
+    if (_curHour.count >= (uint16_t)SAMPLES * 60) {
+      _day.push(_curHour);
+      _curHour.count = 0;
+    }
+  }
+  return this->value();
+}
+
+template<const uint8_t MEDIAN, const uint8_t SAMPLES, const uint8_t EMA_SHIFT>
+int16_t SensorFilter<MEDIAN, SAMPLES, EMA_SHIFT>::median() const {
+  int16_t sorted[MEDIAN];
+
+  if (! _median)
+    return INVALID;
+  for (uint8_t i = 0; i < _median; ++i) { // Insertion sort, MEDIAN is small
+    int16_t value = _samples[i];
+    uint8_t j = i;
+
+    for (; j && (sorted[j - 1] > value); --j) {
+      sorted[j] = sorted[j - 1];
+    }
+    sorted[j] = value;
+  }
+  return sorted[_median / 2];
+}
+
+template<const uint8_t MEDIAN, const uint8_t SAMPLES, const uint8_t EMA_SHIFT>
+int16_t SensorFilter<MEDIAN, SAMPLES, EMA_SHIFT>::min(window_t window) const {
+  bucket_t bucket = stats(window);
+
+  return bucket.count ? bucket.min : INVALID;
+}
+
+template<const uint8_t MEDIAN, const uint8_t SAMPLES, const uint8_t EMA_SHIFT>
+int16_t SensorFilter<MEDIAN, SAMPLES, EMA_SHIFT>::max(window_t window) const {
+  bucket_t bucket = stats(window);
+
+  return bucket.count ? bucket.max : INVALID;
+}
+
+template<const uint8_t MEDIAN, const uint8_t SAMPLES, const uint8_t EMA_SHIFT>
+int16_t SensorFilter<MEDIAN, SAMPLES, EMA_SHIFT>::mean(window_t window) const {
+  bucket_t bucket = stats(window);
+
+  if (! bucket.count)
+    return INVALID;
+  return (bucket.sum + (bucket.sum < 0 ? -(int32_t)bucket.count : (int32_t)bucket.count) / 2) / (int32_t)bucket.count;
+}
+
+template<const uint8_t MEDIAN, const uint8_t SAMPLES, const uint8_t EMA_SHIFT>
+window_bucket_t SensorFilter<MEDIAN, SAMPLES, EMA_SHIFT>::stats(window_t window) const {
+  bucket_t result;
+
+  result.count = 0;
+  if (window == WINDOW_MINUTE) {
+    _minute.merge(result);
+  } else {
+    SlidingWindow<SAMPLES>::add(result, _curMinute);
+    if (window == WINDOW_DAY) { // Finished minutes of current hour are in _curHour, last 60 minutes overlap it and _day
+      SlidingWindow<SAMPLES>::add(result, _curHour);
+      _day.merge(result);
+    } else {
+      _hour.merge(result);
+    }
+  }
+  return result;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <Arduino.h>
+#include "ActionQueue.h"
+
+/*
+ * Stackless (protothread-like) task to be used as ActionQueue action.
+ * Task function must return uint32_t and keep its state in static variables,
+ * because locals are lost on every TASK_AWAIT...() / TASK_DELAY().
+ * Waits are returned as delays from now (ACTION_FROM_NOW), so the queue resumes task at its deadline
+ * even if it was run late.
+ *
+ * static uint32_t blinking() {
+ *   static Task task;
+ *
+ *   TASK_BEGIN(task);
+ *   while (true) {
+ *     digitalWrite(LED_BUILTIN, ! digitalRead(LED_BUILTIN));
+ *     TASK_DELAY(task, 500);
+ *   }
+ *   TASK_END(task);
+ * }
+ */
+class Task {
+public:
+  Task() : _line(0), _deadline(0) {}
+
+  void reset() {
+    _line = 0;
+  }
+
+  uint16_t _line; // Resume point
+  uint32_t _deadline;
+};
+
+#define TASK_BEGIN(task) switch ((task)._line) { case 0:
+
+#define TASK_AWAIT_UNTIL(task, deadline) \
+  do { \
+    (task)._deadline = (deadline); \
+    (task)._line = __LINE__; \
+  case __LINE__: \
+    { \
+      int32_t _wait = (task)._deadline - millis(); \
+      if (_wait > 0) \
+        return _wait | ACTION_FROM_NOW; \
+    } \
+  } while (0)
+
+#define TASK_DELAY(task, ms) TASK_AWAIT_UNTIL(task, millis() + (ms))
+
+#define TASK_AWAIT(task, cond, poll) \
+  do { \
+    (task)._line = __LINE__; \
+  case __LINE__: \
+    if (! (cond)) \
+      return (poll) | ACTION_FROM_NOW; \
+  } while (0)
+
+#define TASK_YIELD(task) TASK_DELAY(task, 1)
+
+#define TASK_END(task) } (task)._line = 0; return 0
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Print.h>
+
+class TaskStats {
+public:
+  static const uint8_t TIME_BUCKETS = 16; // Power of 2 (1 us. .. 32 ms. and more)
+  static const uint8_t LATENESS_BUCKETS = 8; // Power of 2 (0 ms. .. 64 ms. and more)
+
+  TaskStats() {
+    clear();
+  }
+
+  void clear();
+  static uint32_t start() {
+    return ESP.getCycleCount();
+  }
+  void stop(uint32_t start, uint32_t lateness = 0, bool overrun = false);
+
+  uint32_t count() const {
+    return _count;
+  }
+  uint32_t overruns() const {
+    return _overruns;
+  }
+  uint32_t minTime() const {
+    return _count ? _min_time : 0;
+  }
+  uint32_t maxTime() const {
+    return _max_time;
+  }
+  uint64_t totalTime() const {
+    return _total_time;
+  }
+  uint32_t maxLateness() const {
+    return _max_lateness;
+  }
+
+  static void printJson(Print &out, const TaskStats *const *stats, const char *const *names, uint8_t count);
+  static void printPrometheus(Print &out, const TaskStats *const *stats, const char *const *names, uint8_t count);
+
+protected:
+  static uint8_t bucket(uint32_t value, uint8_t buckets);
+  static void printHistogram(Print &out, PGM_P metric, const TaskStats *const *stats, const char *const *names, uint8_t count, bool lateness);
+
+  uint32_t _count;
+  uint32_t _overruns;
+  uint32_t _min_time; // in us.
+  uint32_t _max_time; // in us.
+  uint64_t _total_time; // in us.
+  uint32_t _max_lateness; // in ms.
+  uint64_t _total_lateness; // in ms.
+  uint32_t _time_hist[TIME_BUCKETS];
+  uint32_t _lateness_hist[LATENESS_BUCKETS];
+};
+
+inline void TaskStats::clear() {
+  memset(this, 0, sizeof(*this));
+  _min_time = 0xFFFFFFFF;
+}
+
+inline uint8_t TaskStats::bucket(uint32_t value, uint8_t buckets) {
+  uint8_t result = 0;
+
+  while (value > 1) {
+    value >>= 1;
+    ++result;
+  }
+  return _min(result, (uint8_t)(buckets - 1));
+}
+
+inline void TaskStats::stop(uint32_t start, uint32_t lateness, bool overrun) {
+  uint32_t time = (ESP.getCycleCount() - start) / ESP.getCpuFreqMHz();
+
+  ++_count;
+  if (overrun)
+    ++_overruns;
+  if (time < _min_time)
+    _min_time = time;
+  if (time > _max_time)
+    _max_time = time;
+  _total_time += time;
+  if (lateness > _max_lateness)
+    _max_lateness = lateness;
+  _total_lateness += lateness;
+  ++_time_hist[bucket(time, TIME_BUCKETS)];
+  ++_lateness_hist[lateness ? bucket(lateness, LATENESS_BUCKETS - 1) + 1 : 0];
+}
+
+inline void TaskStats::printJson(Print &out, const TaskStats *const *stats, const char *const *names, uint8_t count) {
+  out.print('{');
+  for (uint8_t i = 0; i < count; ++i) {
+    const TaskStats *s = stats[i];
+
+    if (i)
+      out.print(',');
+    out.print('"');
+    out.print(FPSTR(names[i]));
+    out.printf_P(PSTR("\":{\"count\":%u,\"overruns\":%u,\"time_us\":{\"min\":%u,\"max\":%u,\"total\":%llu,\"hist\":["), s->count(), s->overruns(), s->minTime(), s->maxTime(), s->totalTime());
+    for (uint8_t j = 0; j < TIME_BUCKETS; ++j) {
+      if (j)
+        out.print(',');
+      out.print(s->_time_hist[j]);
+    }
+    out.printf_P(PSTR("]},\"lateness_ms\":{\"max\":%u,\"total\":%llu,\"hist\":["), s->maxLateness(), s->_total_lateness);
+    for (uint8_t j = 0; j < LATENESS_BUCKETS; ++j) {
+      if (j)
+        out.print(',');
+      out.print(s->_lateness_hist[j]);
+    }
+    out.print(F("]}}"));
+  }
+  out.print('}');
+}
+
+inline void TaskStats::printHistogram(Print &out, PGM_P metric, const TaskStats *const *stats, const char *const *names, uint8_t count, bool lateness) {
+  out.printf_P(PSTR("# TYPE %S histogram\n"), metric);
+  for (uint8_t i = 0; i < count; ++i) {
+    const uint32_t *hist = lateness ? stats[i]->_lateness_hist : stats[i]->_time_hist;
+    uint8_t buckets = lateness ? LATENESS_BUCKETS : TIME_BUCKETS;
+    uint32_t total = 0;
+
+    for (uint8_t j = 0; j < buckets - 1; ++j) {
+      total += hist[j];
+      // Bucket j holds values below 2^(j+1) (lateness is shifted by one for zero bucket)
+      out.printf_P(PSTR("%S_bucket{task=\"%S\",le=\"%u\"} %u\n"), metric, names[i], lateness ? (j ? (1U << j) - 1 : 0) : (1U << (j + 1)) - 1, total);
+    }
+    out.printf_P(PSTR("%S_bucket{task=\"%S\",le=\"+Inf\"} %u\n"), metric, names[i], stats[i]->count());
+    out.printf_P(PSTR("%S_sum{task=\"%S\"} %llu\n"), metric, names[i], lateness ? stats[i]->_total_lateness : stats[i]->totalTime());
+    out.printf_P(PSTR("%S_count{task=\"%S\"} %u\n"), metric, names[i], stats[i]->count());
+  }
+}
+
+inline void TaskStats::printPrometheus(Print &out, const TaskStats *const *stats, const char *const *names, uint8_t count) {
+  printHistogram(out, PSTR("wificlock_task_duration_us"), stats, names, count, false);
+  printHistogram(out, PSTR("wificlock_task_lateness_ms"), stats, names, count, true);
+  out.print(F("# TYPE wificlock_task_duration_us_min gauge\n"));
+  for (uint8_t i = 0; i < count; ++i) {
+    out.printf_P(PSTR("wificlock_task_duration_us_min{task=\"%S\"} %u\n"), names[i], stats[i]->minTime());
+  }
+  out.print(F("# TYPE wificlock_task_duration_us_max gauge\n"));
+  for (uint8_t i = 0; i < count; ++i) {
+    out.printf_P(PSTR("wificlock_task_duration_us_max{task=\"%S\"} %u\n"), names[i], stats[i]->maxTime());
+  }
+  out.print(F("# TYPE wificlock_task_overruns_total counter\n"));
+  for (uint8_t i = 0; i < count; ++i) {
+    out.printf_P(PSTR("wificlock_task_overruns_total{task=\"%S\"} %u\n"), names[i], stats[i]->overruns());
+  }
+}
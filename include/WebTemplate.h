@@ -0,0 +1,38 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Print.h>
+
+#define TPL(id) "\x01" id // Placeholder with one character id in template
+
+/*
+ * Renders PROGMEM template into chunks of any size (AsyncWebServer chunked response filler):
+ * text goes straight from flash to the chunk, placeholders are printed by callback into the chunk.
+ * Placeholder output beyond the chunk is kept if short (up to CARRY_SIZE bytes, e.g. numbers),
+ * otherwise it is rendered again into the next chunk skipping bytes already sent,
+ * so long placeholders must not change while the page is sent.
+ * Callback may print long output in parts instead (e.g. log records): it advances cursor past the part
+ * and is called again while it does, part that did not fit is rendered again from the cursor it started at.
+ */
+class WebTemplate {
+public:
+  typedef void (*render_t)(Print &out, char id, uint32_t data, uint32_t &cursor);
+
+  static const char MARKER = '\x01';
+  static const uint8_t CARRY_SIZE = 32;
+
+  WebTemplate(PGM_P tpl, render_t render, uint32_t data = 0, uint32_t cursor = 0);
+
+  size_t read(uint8_t *buffer, size_t size); // Returns 0 at the end
+
+protected:
+  PGM_P _tpl;
+  render_t _render;
+  uint32_t _data; // Passed to callback (captured when page was requested)
+  uint32_t _cursor; // Of placeholder printed in parts
+  uint16_t _pos, _length; // In template
+  uint16_t _skip; // Placeholder bytes already sent
+  char _id; // Placeholder being rendered, 0 if none
+  uint8_t _carryPos, _carryLen;
+  uint8_t _carry[CARRY_SIZE];
+};
@@ -0,0 +1,410 @@
+#include <pgmspace.h>
+#include "History.h"
+#include "Crc16.h"
+
+static const uint16_t TIER_PERIODS[History::TIER_COUNT] PROGMEM = { 2, 60, 900 }; // Raw period is nominal only
+static const char PENDING_PATH[] PROGMEM = "/histp.dat";
+
+static uint8_t fixedToStr(char *str, int16_t value) { // Hundredths to string with two decimals
+  return sprintf_P(str, PSTR("%s%u.%02u"), (value < 0) ? "-" : "", abs(value) / 100, abs(value) % 100);
+}
+
+History::History(FS &fs) : _fs(fs) {
+  for (uint8_t i = 0; i < TIER_COUNT; ++i) {
+    _tiers[i].block.count = 0;
+    _averages[i].count = 0;
+  }
+}
+
+bool History::add(uint32_t time, int16_t temp, int16_t hum) {
+  bool result;
+
+  if ((! time) || (temp == -32768) || (hum == -32768)) // No time yet or invalid value
+    return false;
+  result = append(TIER_RAW, time, temp, hum);
+  for (uint8_t tier = TIER_MINUTE; tier < TIER_COUNT; ++tier) {
+    if (! average((tier_t)tier, time, temp, hum))
+      result = false;
+  }
+  return result;
+}
+
+bool History::flush() {
+  char name[16];
+  bool result = true;
+
+  for (uint8_t tier = TIER_RAW; tier < TIER_COUNT; ++tier) {
+    if (! store((tier_t)tier))
+      result = false;
+  }
+  strcpy_P(name, PENDING_PATH);
+  _fs.remove(name); // Would be stored twice
+  return result;
+}
+
+bool History::save() {
+  char name[16];
+  File file;
+  uint16_t crc;
+  bool result;
+
+  strcpy_P(name, PENDING_PATH);
+  file = _fs.open(name, "w");
+  if (! file)
+    return false;
+  crc = crc16((const uint8_t*)_averages, sizeof(_averages), crc16((const uint8_t*)_tiers, sizeof(_tiers)));
+  result = (file.write((const uint8_t*)_tiers, sizeof(_tiers)) == sizeof(_tiers)) &&
+    (file.write((const uint8_t*)_averages, sizeof(_averages)) == sizeof(_averages)) &&
+    (file.write((const uint8_t*)&crc, sizeof(crc)) == sizeof(crc));
+  file.close();
+  return result;
+}
+
+bool History::restore() {
+  char name[16];
+  File file;
+  tier_state_t tiers[TIER_COUNT];
+  average_t averages[TIER_COUNT];
+  uint16_t crc;
+  bool result;
+
+  strcpy_P(name, PENDING_PATH);
+  file = _fs.open(name, "r");
+  if (! file)
+    return false;
+  result = (file.read((uint8_t*)tiers, sizeof(tiers)) == sizeof(tiers)) &&
+    (file.read((uint8_t*)averages, sizeof(averages)) == sizeof(averages)) &&
+    (file.read((uint8_t*)&crc, sizeof(crc)) == sizeof(crc)) &&
+    (crc16((const uint8_t*)averages, sizeof(averages), crc16((const uint8_t*)tiers, sizeof(tiers))) == crc);
+  file.close();
+  if (result) {
+    for (uint8_t tier = TIER_RAW; tier < TIER_COUNT; ++tier) {
+      if (tiers[tier].block.count && (tiers[tier].block.first > stored((tier_t)tier))) // Not filled and stored before crash
+        _tiers[tier] = tiers[tier];
+      else
+        _tiers[tier].block.count = 0;
+    }
+    memcpy(_averages, averages, sizeof(_averages));
+  }
+  return result;
+}
+
+uint16_t History::period(tier_t tier) {
+  return pgm_read_word(&TIER_PERIODS[tier]);
+}
+
+void History::path(char *str, tier_t tier, bool old) {
+  sprintf_P(str, PSTR("/hist%u%s.dat"), tier, old ? ".1" : "");
+}
+
+bool History::valid(const block_t &block) {
+  if ((! block.count) || (block.length > sizeof(block.data)))
+    return false;
+  return crc16(block.data, block.length, crc16((const uint8_t*)&block, BLOCK_HEADER)) == block.crc;
+}
+
+uint8_t History::zigzag(uint8_t *data, int32_t value) {
+  uint32_t z = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+  uint8_t len = 0;
+
+  while (z >= 0x80) {
+    data[len++] = (z & 0x7F) | 0x80;
+    z >>= 7;
+  }
+  data[len++] = z;
+  return len;
+}
+
+uint8_t History::unzigzag(const uint8_t *data, uint8_t size, int32_t *value) {
+  uint32_t z = 0;
+
+  for (uint8_t i = 0; (i < size) && (i < 5); ++i) {
+    z |= (uint32_t)(data[i] & 0x7F) << (i * 7);
+    if (! (data[i] & 0x80)) {
+      *value = (z >> 1) ^ -(int32_t)(z & 0x01);
+      return i + 1;
+    }
+  }
+  return 0; // Truncated
+}
+
+bool History::append(tier_t tier, uint32_t time, int16_t temp, int16_t hum) {
+  tier_state_t &state = _tiers[tier];
+  bool result = true;
+
+  if (state.block.count) {
+    uint8_t data[15];
+    uint8_t len;
+    int32_t delta;
+
+    if (time <= state.block.last) // Time went back
+      return false;
+    delta = time - state.block.last;
+    len = zigzag(data, delta - state.delta);
+    len += zigzag(&data[len], temp - state.temp);
+    len += zigzag(&data[len], hum - state.hum);
+    if ((state.block.count < 255) && (state.block.length + len <= sizeof(state.block.data))) {
+      memcpy(&state.block.data[state.block.length], data, len);
+      state.block.length += len;
+      ++state.block.count;
+      state.block.last = time;
+      state.delta = delta;
+      state.temp = temp;
+      state.hum = hum;
+      return true;
+    }
+    result = store(tier);
+  }
+  state.block.first = state.block.last = time;
+  state.block.temp = state.temp = temp;
+  state.block.hum = state.hum = hum;
+  state.block.count = 1;
+  state.block.length = 0;
+  state.delta = 0;
+  return result;
+}
+
+bool History::average(tier_t tier, uint32_t time, int16_t temp, int16_t hum) {
+  average_t &avg = _averages[tier];
+  uint32_t start = time - time % period(tier);
+  bool result = true;
+
+  if (avg.count && (avg.start != start)) { // Period is over
+    int16_t half = avg.count / 2;
+
+    result = append(tier, avg.start, (avg.temp + (avg.temp < 0 ? -half : half)) / avg.count,
+      (avg.hum + (avg.hum < 0 ? -half : half)) / avg.count);
+    avg.count = 0;
+  }
+  if (! avg.count) {
+    avg.start = start;
+    avg.temp = 0;
+    avg.hum = 0;
+  }
+  avg.temp += temp;
+  avg.hum += hum;
+  ++avg.count;
+  return result;
+}
+
+bool History::store(tier_t tier) {
+  block_t &block = _tiers[tier].block;
+  char name[16];
+  File file;
+  bool result;
+
+  if (! block.count)
+    return true;
+  memset(&block.data[block.length], 0, sizeof(block.data) - block.length);
+  block.crc = crc16(block.data, block.length, crc16((const uint8_t*)&block, BLOCK_HEADER));
+  path(name, tier);
+  file = _fs.open(name, "a");
+  if (file && (file.size() >= FILE_SIZE)) { // Rotate
+    char old[16];
+
+    file.close();
+    path(old, tier, true);
+    _fs.remove(old);
+    _fs.rename(name, old);
+    file = _fs.open(name, "a");
+  }
+  if (file) {
+    if (file.size() % BLOCK_SIZE) // Torn write of previous block
+      file.truncate(file.size() - file.size() % BLOCK_SIZE);
+    result = file.write((const uint8_t*)&block, BLOCK_SIZE) == BLOCK_SIZE;
+    file.close();
+  } else
+    result = false;
+  block.count = 0;
+  return result;
+}
+
+uint32_t History::stored(tier_t tier) {
+  char name[16];
+  File file;
+  uint32_t result = 0;
+
+  path(name, tier);
+  file = _fs.open(name, "r");
+  if (file) {
+    uint32_t blocks = file.size() / BLOCK_SIZE;
+    block_t block;
+
+    if (blocks && file.seek((blocks - 1) * BLOCK_SIZE) && (file.read((uint8_t*)&block, BLOCK_SIZE) == BLOCK_SIZE) && valid(block))
+      result = block.last;
+    file.close();
+  }
+  return result;
+}
+
+HistoryReader::HistoryReader(const History &history, History::tier_t tier, uint32_t from, uint32_t to, format_t format) :
+  _history(history), _from(from), _to(to), _index(0), _blocks(0), _emitted(0), _pos(0), _offset(0),
+  _tier(tier), _source(SOURCE_OLD), _format(format), _first(true), _done(false), _linePos(0) {
+  _block.count = 0;
+  if (format == FORMAT_JSON)
+    strcpy_P(_line, PSTR("[\n"));
+  else
+    strcpy_P(_line, PSTR("time,temp,hum\n"));
+  _lineLen = strlen(_line);
+}
+
+bool HistoryReader::next(History::point_t &point) {
+  while (true) {
+    if (_pos >= _block.count) {
+      if (! nextBlock())
+        return false;
+      _pos = 0;
+      _offset = 0;
+    }
+    if (! _pos) {
+      _point.time = _block.first;
+      _point.temp = _block.temp;
+      _point.hum = _block.hum;
+      _delta = 0;
+    } else {
+      int32_t dod, temp, hum;
+      uint8_t len;
+
+      if ((! (len = History::unzigzag(&_block.data[_offset], _block.length - _offset, &dod))) ||
+        (! (_offset += len, len = History::unzigzag(&_block.data[_offset], _block.length - _offset, &temp))) ||
+        (! (_offset += len, len = History::unzigzag(&_block.data[_offset], _block.length - _offset, &hum)))) { // Corrupted block
+        _pos = _block.count;
+        continue;
+      }
+      _offset += len;
+      _delta += dod;
+      _point.time += _delta;
+      _point.temp += temp;
+      _point.hum += hum;
+    }
+    ++_pos;
+    if (_point.time > _to) { // Points are ordered, nothing more
+      _source = SOURCE_END;
+      _block.count = 0;
+      return false;
+    }
+    if ((_point.time >= _from) && (_point.time > _emitted)) {
+      _emitted = _point.time;
+      point = _point;
+      return true;
+    }
+  }
+}
+
+size_t HistoryReader::read(uint8_t *data, size_t size) {
+  size_t result = 0;
+
+  while (result < size) {
+    if (_linePos < _lineLen) {
+      size_t len = _min((size_t)(_lineLen - _linePos), size - result);
+
+      memcpy(&data[result], &_line[_linePos], len);
+      _linePos += len;
+      result += len;
+    } else if (_done) {
+      break;
+    } else {
+      History::point_t point;
+
+      if (next(point)) {
+        _lineLen = format(_line, point);
+        _first = false;
+      } else {
+        if (_format == FORMAT_JSON)
+          strcpy_P(_line, _first ? PSTR("]\n") : PSTR("\n]\n"));
+        else
+          *_line = '\0';
+        _lineLen = strlen(_line);
+        _done = true;
+      }
+      _linePos = 0;
+    }
+  }
+  return result;
+}
+
+bool HistoryReader::nextBlock() {
+  while (true) {
+    switch (_source) {
+      case SOURCE_OLD:
+      case SOURCE_CURRENT:
+        if (! _file) {
+          if (! openFile(_source == SOURCE_OLD)) {
+            _source = (source_t)(_source + 1);
+            break;
+          }
+        }
+        if (_index < _blocks) {
+          if (readBlock(_index++) && History::valid(_block)) {
+            if (_block.first > _to) {
+              _file.close();
+              _source = SOURCE_END;
+              return false;
+            }
+            return true;
+          }
+        } else {
+          _file.close();
+          _source = (source_t)(_source + 1);
+        }
+        break;
+      case SOURCE_PENDING:
+        _block = _history.pending(_tier);
+        _source = SOURCE_END;
+        if (_block.count && (_block.first <= _to))
+          return true;
+        _block.count = 0;
+        return false;
+      default:
+        _block.count = 0;
+        return false;
+    }
+  }
+}
+
+bool HistoryReader::openFile(bool old) {
+  char name[16];
+  uint32_t lo = 0, hi;
+
+  History::path(name, _tier, old);
+  _file = _history.fs().open(name, "r");
+  if (! _file)
+    return false;
+  _blocks = _file.size() / History::BLOCK_SIZE;
+  hi = _blocks;
+  while (lo < hi) { // First block with last point not before range
+    uint32_t mid = (lo + hi) / 2;
+
+    if (readBlock(mid) && (_block.last < _from))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  _index = lo;
+  return true;
+}
+
+bool HistoryReader::readBlock(uint32_t index) {
+  _block.count = 0;
+  return _file.seek(index * History::BLOCK_SIZE) && (_file.read((uint8_t*)&_block, History::BLOCK_SIZE) == History::BLOCK_SIZE);
+}
+
+uint8_t HistoryReader::format(char *str, const History::point_t &point) {
+  uint8_t len;
+
+  if (_format == FORMAT_JSON) {
+    len = sprintf_P(str, PSTR("%s[%u,"), _first ? "" : ",\n", point.time);
+    len += fixedToStr(&str[len], point.temp);
+    str[len++] = ',';
+    len += fixedToStr(&str[len], point.hum);
+    str[len++] = ']';
+  } else {
+    len = sprintf_P(str, PSTR("%u,"), point.time);
+    len += fixedToStr(&str[len], point.temp);
+    str[len++] = ',';
+    len += fixedToStr(&str[len], point.hum);
+    str[len++] = '\n';
+  }
+  str[len] = '\0';
+  return len;
+}
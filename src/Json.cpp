@@ -0,0 +1,365 @@
+#include <pgmspace.h>
+#include "Json.h"
+
+void JsonWriter::beginObject() {
+  begin('{');
+}
+
+void JsonWriter::endObject() {
+  end('}');
+}
+
+void JsonWriter::beginArray() {
+  begin('[');
+}
+
+void JsonWriter::endArray() {
+  end(']');
+}
+
+void JsonWriter::key(PGM_P name) {
+  separate();
+  escape(name, true);
+  _out.print(':');
+  _key = true;
+}
+
+void JsonWriter::value(int value) {
+  separate();
+  _out.print(value);
+}
+
+void JsonWriter::value(unsigned int value) {
+  separate();
+  _out.print(value);
+}
+
+void JsonWriter::value(long value) {
+  separate();
+  _out.print(value);
+}
+
+void JsonWriter::value(unsigned long value) {
+  separate();
+  _out.print(value);
+}
+
+void JsonWriter::value(bool value) {
+  separate();
+  _out.print(value ? F("true") : F("false"));
+}
+
+void JsonWriter::value(const char *str) {
+  separate();
+  escape(str, false);
+}
+
+void JsonWriter::valueP(PGM_P str) {
+  separate();
+  escape(str, true);
+}
+
+void JsonWriter::fixed(int32_t value, uint8_t decimals) {
+  uint32_t div = 1;
+  uint32_t abs;
+
+  separate();
+  for (uint8_t i = 0; i < decimals; ++i)
+    div *= 10;
+  abs = (value < 0) ? -(uint32_t)value : value;
+  if (value < 0)
+    _out.print('-');
+  _out.print(abs / div);
+  if (decimals)
+    _out.printf_P(PSTR(".%0*u"), decimals, abs % div);
+}
+
+void JsonWriter::null() {
+  separate();
+  _out.print(F("null"));
+}
+
+void JsonWriter::separate() {
+  if (_key) {
+    _key = false;
+  } else if (_depth) {
+    if (_first & (1 << _depth))
+      _first &= ~(1 << _depth);
+    else
+      _out.print(',');
+  }
+}
+
+void JsonWriter::begin(char c) {
+  separate();
+  _out.print(c);
+  if (_depth < MAX_DEPTH - 1) {
+    ++_depth;
+    _first |= 1 << _depth;
+  }
+}
+
+void JsonWriter::end(char c) {
+  if (_depth)
+    --_depth;
+  _out.print(c);
+}
+
+void JsonWriter::escape(const char *str, bool progmem) { // Runs of plain characters are written at once
+  const char *run = str;
+  char c;
+
+  _out.print('"');
+  while (true) {
+    c = progmem ? pgm_read_byte(str) : *str;
+    if ((! c) || (c == '"') || (c == '\\') || ((uint8_t)c < 0x20)) {
+      if (str > run) {
+        if (progmem) {
+          char buf[32];
+
+          while (str > run) {
+            size_t len = _min((size_t)(str - run), sizeof(buf));
+
+            memcpy_P(buf, run, len);
+            _out.write((const uint8_t*)buf, len);
+            run += len;
+          }
+        } else
+          _out.write((const uint8_t*)run, str - run);
+      }
+      if (! c)
+        break;
+      _out.print('\\');
+      if ((c == '"') || (c == '\\'))
+        _out.print(c);
+      else if (c == '\n')
+        _out.print('n');
+      else if (c == '\r')
+        _out.print('r');
+      else if (c == '\t')
+        _out.print('t');
+      else
+        _out.printf_P(PSTR("u%04x"), (uint8_t)c);
+      run = str + 1;
+    }
+    ++str;
+  }
+  _out.print('"');
+}
+
+JsonParser::JsonParser(handler_t handler, void *arg) : _handler(handler), _arg(arg), _objects(0), _unicode(0),
+  _state(STATE_VALUE), _depth(0), _len(0), _hex(0), _isKey(false) {}
+
+bool JsonParser::parse(const char *data, size_t size) {
+  while (size-- && (_state != STATE_ERROR)) {
+    if (! step(*data++))
+      _state = STATE_ERROR;
+  }
+  return _state != STATE_ERROR;
+}
+
+bool JsonParser::step(char c) {
+  switch (_state) {
+    case STATE_STRING:
+      if (c == '"') {
+        if (_isKey) {
+          _keyBuf[_len] = '\0';
+          _state = STATE_COLON;
+          return true;
+        }
+        _token[_len] = '\0';
+        return emit(JSON_STRING, _token) && endValue();
+      }
+      if (c == '\\') {
+        _state = STATE_ESCAPE;
+        return true;
+      }
+      return ((uint8_t)c >= 0x20) && append(c);
+    case STATE_ESCAPE:
+      _state = STATE_STRING;
+      switch (c) {
+        case '"':
+        case '\\':
+        case '/':
+          return append(c);
+        case 'b':
+          return append('\b');
+        case 'f':
+          return append('\f');
+        case 'n':
+          return append('\n');
+        case 'r':
+          return append('\r');
+        case 't':
+          return append('\t');
+        case 'u':
+          _unicode = 0;
+          _hex = 0;
+          _state = STATE_UNICODE;
+          return true;
+      }
+      return false;
+    case STATE_UNICODE:
+      if (! isxdigit((uint8_t)c))
+        return false;
+      _unicode = (_unicode << 4) | (isdigit((uint8_t)c) ? c - '0' : (c | 0x20) - 'a' + 10);
+      if (++_hex < 4)
+        return true;
+      _state = STATE_STRING;
+      if (! _unicode) // Would cut string
+        return false;
+      if (_unicode < 0x80)
+        return append(_unicode);
+      if (_unicode < 0x800)
+        return append(0xC0 | (_unicode >> 6)) && append(0x80 | (_unicode & 0x3F));
+      return append(0xE0 | (_unicode >> 12)) && append(0x80 | ((_unicode >> 6) & 0x3F)) && append(0x80 | (_unicode & 0x3F)); // Surrogates are not paired
+    case STATE_NUMBER:
+      if (isdigit((uint8_t)c) || (c == '-') || (c == '+') || (c == '.') || (c == 'e') || (c == 'E'))
+        return append(c);
+      _token[_len] = '\0';
+      return validNumber(_token) && emit(JSON_NUMBER, _token) && endValue() && step(c);
+    case STATE_LITERAL:
+      if (isalpha((uint8_t)c))
+        return append(c);
+      _token[_len] = '\0';
+      if (! strcmp_P(_token, PSTR("true")))
+        return emit(JSON_TRUE) && endValue() && step(c);
+      if (! strcmp_P(_token, PSTR("false")))
+        return emit(JSON_FALSE) && endValue() && step(c);
+      if (! strcmp_P(_token, PSTR("null")))
+        return emit(JSON_NULL) && endValue() && step(c);
+      return false;
+    case STATE_ERROR:
+      return false;
+    default:
+      break;
+  }
+  if ((c == ' ') || (c == '\t') || (c == '\r') || (c == '\n'))
+    return true;
+  switch (_state) {
+    case STATE_VALUE_OR_END:
+      if (c == ']')
+        return close(false);
+      // no break
+    case STATE_VALUE:
+      _len = 0;
+      if (c == '{')
+        return open(true);
+      if (c == '[')
+        return open(false);
+      if (c == '"') {
+        _isKey = false;
+        _state = STATE_STRING;
+        return true;
+      }
+      if (isdigit((uint8_t)c) || (c == '-')) {
+        _state = STATE_NUMBER;
+        return append(c);
+      }
+      if (isalpha((uint8_t)c)) {
+        _state = STATE_LITERAL;
+        return append(c);
+      }
+      return false;
+    case STATE_KEY_OR_END:
+      if (c == '}')
+        return close(true);
+      // no break
+    case STATE_KEY:
+      if (c != '"')
+        return false;
+      _len = 0;
+      _isKey = true;
+      _state = STATE_STRING;
+      return true;
+    case STATE_COLON:
+      if (c != ':')
+        return false;
+      _state = STATE_VALUE;
+      return true;
+    case STATE_NEXT:
+      if (c == ',') {
+        _state = inObject() ? STATE_KEY : STATE_VALUE;
+        return true;
+      }
+      if ((c == '}') || (c == ']'))
+        return close(c == '}');
+      return false;
+    default: // Done, only trailing spaces are allowed
+      return false;
+  }
+}
+
+bool JsonParser::append(char c) {
+  if (_isKey && (_state == STATE_STRING)) {
+    if (_len >= KEY_SIZE - 1)
+      return false;
+    _keyBuf[_len++] = c;
+  } else {
+    if (_len >= TOKEN_SIZE - 1)
+      return false;
+    _token[_len++] = c;
+  }
+  return true;
+}
+
+bool JsonParser::emit(event_t event, const char *value) {
+  const char *key = nullptr;
+
+  if ((event != JSON_OBJECT_END) && (event != JSON_ARRAY_END) && inObject())
+    key = _keyBuf;
+  return _handler(_arg, event, _depth, key, value);
+}
+
+bool JsonParser::open(bool object) {
+  if ((_depth >= MAX_DEPTH) || (! emit(object ? JSON_OBJECT : JSON_ARRAY)))
+    return false;
+  if (object)
+    _objects |= 1 << _depth;
+  else
+    _objects &= ~(1 << _depth);
+  ++_depth;
+  _state = object ? STATE_KEY_OR_END : STATE_VALUE_OR_END;
+  return true;
+}
+
+bool JsonParser::close(bool object) {
+  if ((! _depth) || (inObject() != object))
+    return false;
+  --_depth;
+  return emit(object ? JSON_OBJECT_END : JSON_ARRAY_END) && endValue();
+}
+
+bool JsonParser::endValue() {
+  _isKey = false;
+  _state = _depth ? STATE_NEXT : STATE_DONE;
+  return true;
+}
+
+bool JsonParser::validNumber(const char *str) { // -?(0|[1-9]\d*)(\.\d+)?([eE][+-]?\d+)?
+  if (*str == '-')
+    ++str;
+  if (*str == '0')
+    ++str;
+  else if (isdigit(*str)) {
+    while (isdigit(*str))
+      ++str;
+  } else
+    return false;
+  if (*str == '.') {
+    if (! isdigit(*++str))
+      return false;
+    while (isdigit(*str))
+      ++str;
+  }
+  if ((*str == 'e') || (*str == 'E')) {
+    ++str;
+    if ((*str == '+') || (*str == '-'))
+      ++str;
+    if (! isdigit(*str))
+      return false;
+    while (isdigit(*str))
+      ++str;
+  }
+  return ! *str;
+}
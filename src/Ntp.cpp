@@ -1,10 +1,29 @@
 #include <Arduino.h>
 #include <ESP8266WiFi.h>
 #include <WiFiUdp.h>
+#include <user_interface.h>
+#include <coredecls.h>
 #include "Ntp.h"
 
+const uint32_t NTP_DRIFT = 20; // 50 ppm (1 ms per 20 sec.)
+const uint32_t NTP_RESTART_ERROR = 1000; // Unknown restart duration (in ms.)
+
+struct __attribute__((__packed__)) ntp_rtc_t {
+  uint32_t time; // Epoch at checkpoint
+  uint32_t synced; // Epoch of last NTP sync
+  uint32_t error; // Error at last sync (in ms.)
+  uint32_t rtc; // RTC counter at checkpoint
+  uint32_t cali; // RTC period (in us. << 12)
+  uint32_t frac; // Milliseconds fraction of epoch
+  uint32_t crc;
+};
+
 static uint32_t _ntp_time = 0;
 static uint32_t _ntp_updated = 0;
+static uint32_t _ntp_synced = 0;
+static uint32_t _ntp_error = 0;
+static uint32_t _ntp_requested = 0;
+static WiFiUDP _ntp_udp;
 
 uint32_t ntpTime() {
   if (_ntp_time) {
@@ -13,54 +32,137 @@ uint32_t ntpTime() {
   return 0;
 }
 
-bool ntpUpdate(const IPAddress &ntp_server, int8_t tz, uint32_t timeout, uint8_t repeat) {
+uint16_t ntpFraction() {
+  if (_ntp_time) {
+    return (millis() - _ntp_updated) % 1000;
+  }
+  return 0;
+}
+
+uint32_t ntpError() {
+  if (_ntp_time) {
+    return _ntp_error + (ntpTime() - _ntp_synced) / NTP_DRIFT;
+  }
+  return 0;
+}
+
+void ntpSave(uint8_t rtc_offset) {
+  if (_ntp_time) {
+    ntp_rtc_t data;
+    uint32_t elapsed = millis() - _ntp_updated;
+
+    data.time = _ntp_time + elapsed / 1000;
+    data.frac = elapsed % 1000;
+    data.synced = _ntp_synced;
+    data.error = _ntp_error;
+    data.rtc = system_get_rtc_time();
+    data.cali = system_rtc_clock_cali_proc();
+    data.crc = crc32(&data, offsetof(ntp_rtc_t, crc));
+    ESP.rtcUserMemoryWrite(rtc_offset, (uint32_t*)&data, sizeof(data));
+  }
+}
+
+bool ntpRestore(uint8_t rtc_offset, uint32_t period) {
+  ntp_rtc_t data;
+
+  if (ESP.rtcUserMemoryRead(rtc_offset, (uint32_t*)&data, sizeof(data)) && (data.crc == crc32(&data, offsetof(ntp_rtc_t, crc))) && data.time) {
+    uint32_t rtc = system_get_rtc_time();
+    uint32_t elapsed; // Since checkpoint (in ms.)
+
+    if (rtc >= data.rtc) { // RTC counter survived restart
+      elapsed = (((uint64_t)(rtc - data.rtc) * data.cali) >> 12) / 1000;
+      _ntp_error = data.error;
+    } else { // Time spent before and during restart is unknown
+      elapsed = millis();
+      _ntp_error = data.error + NTP_RESTART_ERROR + period;
+    }
+    elapsed += data.frac;
+    _ntp_updated = millis() - elapsed % 1000;
+    _ntp_time = data.time + elapsed / 1000;
+    _ntp_synced = data.synced;
+    return true;
+  }
+  return false;
+}
+
+bool ntpRequest(const IPAddress &ntp_server) {
   const uint16_t LOCAL_PORT = 55123;
 
   if (WiFi.isConnected()) {
-    WiFiUDP udp;
-
-    if (udp.begin(LOCAL_PORT)) {
-      do {
-        uint8_t buffer[48];
-
-        memset(buffer, 0, sizeof(buffer));
-        // Initialize values needed to form NTP request
-        buffer[0] = 0B11100011; // LI, Version, Mode
-        buffer[1] = 0; // Stratum, or type of clock
-        buffer[2] = 6; // Polling Interval
-        buffer[3] = 0xEC; // Peer Clock Precision
-        // 8 bytes of zero for Root Delay & Root Dispersion
-        buffer[12] = 49;
-        buffer[13] = 0x4E;
-        buffer[14] = 49;
-        buffer[15] = 52;
-        // all NTP fields have been given values, now
-        // you can send a packet requesting a timestamp
-        if (udp.beginPacket(ntp_server, 123) && (udp.write(buffer, sizeof(buffer)) == sizeof(buffer)) && udp.endPacket()) {
-          uint32_t time = millis();
-          int cb;
-
-          while ((! (cb = udp.parsePacket())) && (millis() - time < timeout)) {
-            delay(1);
-          }
-          if (cb) {
-            // We've received a packet, read the data from it
-            if (udp.read(buffer, sizeof(buffer)) == sizeof(buffer)) { // read the packet into the buffer
-              // the timestamp starts at byte 40 of the received packet and is four bytes,
-              // or two words, long. First, esxtract the two words:
-              _ntp_updated = millis();
-              _ntp_time = (((uint32_t)buffer[40] << 24) | ((uint32_t)buffer[41] << 16) | ((uint32_t)buffer[42] << 8) | buffer[43]) - 2208988800UL;
-              _ntp_time += tz * 3600;
-              return true;
-            }
-          }
-        }
-      } while (repeat--);
+    if (_ntp_udp.begin(LOCAL_PORT)) {
+      uint8_t buffer[48];
+
+      memset(buffer, 0, sizeof(buffer));
+      // Initialize values needed to form NTP request
+      buffer[0] = 0B11100011; // LI, Version, Mode
+      buffer[1] = 0; // Stratum, or type of clock
+      buffer[2] = 6; // Polling Interval
+      buffer[3] = 0xEC; // Peer Clock Precision
+      // 8 bytes of zero for Root Delay & Root Dispersion
+      buffer[12] = 49;
+      buffer[13] = 0x4E;
+      buffer[14] = 49;
+      buffer[15] = 52;
+      // all NTP fields have been given values, now
+      // you can send a packet requesting a timestamp
+      if (_ntp_udp.beginPacket(ntp_server, 123) && (_ntp_udp.write(buffer, sizeof(buffer)) == sizeof(buffer)) && _ntp_udp.endPacket()) {
+        _ntp_requested = millis();
+        return true;
+      }
+      _ntp_udp.stop();
     }
   }
   return false;
 }
 
+bool ntpRequest(const char *ntp_server) {
+  IPAddress ip;
+
+  if (WiFi.hostByName(ntp_server, ip)) {
+    return ntpRequest(ip);
+  }
+  return false;
+}
+
+int8_t ntpCheck(int8_t tz, uint32_t timeout) {
+  if (_ntp_udp.parsePacket()) {
+    uint8_t buffer[48];
+
+    // We've received a packet, read the data from it
+    if (_ntp_udp.read(buffer, sizeof(buffer)) == sizeof(buffer)) { // read the packet into the buffer
+      // the timestamp starts at byte 40 of the received packet and is four bytes,
+      // or two words, long. First, esxtract the two words:
+      _ntp_updated = millis();
+      _ntp_error = 1000 + (_ntp_updated - _ntp_requested) / 2; // Seconds only + half of round trip
+      _ntp_time = (((uint32_t)buffer[40] << 24) | ((uint32_t)buffer[41] << 16) | ((uint32_t)buffer[42] << 8) | buffer[43]) - 2208988800UL;
+      _ntp_time += tz * 3600;
+      _ntp_synced = _ntp_time;
+      _ntp_udp.stop();
+      return 1;
+    }
+  }
+  if (millis() - _ntp_requested >= timeout) {
+    _ntp_udp.stop();
+    return -1;
+  }
+  return 0;
+}
+
+bool ntpUpdate(const IPAddress &ntp_server, int8_t tz, uint32_t timeout, uint8_t repeat) {
+  do {
+    if (ntpRequest(ntp_server)) {
+      int8_t result;
+
+      while (! (result = ntpCheck(tz, timeout))) {
+        delay(1);
+      }
+      if (result > 0)
+        return true;
+    }
+  } while (repeat--);
+  return false;
+}
+
 bool ntpUpdate(const char *ntp_server, int8_t tz, uint32_t timeout, uint8_t repeat) {
   IPAddress ip;
 
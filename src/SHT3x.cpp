@@ -0,0 +1,198 @@
+#include <pgmspace.h>
+#include "SHT3x.h"
+
+void SHT3x::init(int8_t sda, int8_t scl, bool fast, TwoWire &wire) {
+  wire.begin(sda, scl);
+  if (fast)
+    wire.setClock(400000);
+}
+
+void SHT3x::init(bool fast, TwoWire &wire) {
+  wire.begin();
+  if (fast)
+    wire.setClock(400000);
+}
+
+bool SHT3x::begin(uint8_t addr) {
+  if (! addr) { // Auto address (0x44 or 0x45)
+    _addr = 0x44;
+    if (reset())
+      return true;
+    _addr = 0x45;
+    return reset();
+  } else {
+    _addr = addr;
+    return reset();
+  }
+}
+
+bool SHT3x::reset() {
+  _mps = MPS_NONE;
+  return command(0x30A2);
+}
+
+bool SHT3x::heater(bool on) {
+  _wire.beginTransmission(_addr);
+  _wire.write(0x30);
+  if (on)
+    _wire.write(0x6D);
+  else
+    _wire.write(0x66);
+  return (_wire.endTransmission() == 0);
+}
+
+bool SHT3x::start(repeat_t repeat) {
+  static const uint16_t COMMANDS[] PROGMEM = { 0x2416, 0x240B, 0x2400 }; // Without clock stretching
+
+  if ((_mps != MPS_NONE) && (! stop()))
+    return false;
+  _repeat = repeat;
+  _start = millis();
+  return command(pgm_read_word(&COMMANDS[repeat]));
+}
+
+bool SHT3x::startPeriodic(mps_t mps, repeat_t repeat) {
+  static const uint16_t COMMANDS[][3] PROGMEM = {
+    { 0x202F, 0x2024, 0x2032 }, // 0.5 mps
+    { 0x212D, 0x2126, 0x2130 }, // 1 mps
+    { 0x222B, 0x2220, 0x2236 }, // 2 mps
+    { 0x2329, 0x2322, 0x2334 }, // 4 mps
+    { 0x272A, 0x2721, 0x2737 } // 10 mps
+  };
+
+  if (mps == MPS_NONE)
+    return stop();
+  if ((_mps != MPS_NONE) && (! stop()))
+    return false;
+  _repeat = repeat;
+  _start = millis();
+  if (! command(pgm_read_word(&COMMANDS[mps][repeat])))
+    return false;
+  _mps = mps;
+  return true;
+}
+
+bool SHT3x::stop() {
+  if (_mps == MPS_NONE)
+    return true;
+  if (! command(0x3093)) // Break
+    return false;
+  _mps = MPS_NONE;
+  delay(1);
+  return true;
+}
+
+bool SHT3x::poll() const { // Conversion is probably done
+  return millis() - _start >= duration();
+}
+
+int8_t SHT3x::read(int16_t *temp, int16_t *hum) { // 1 on success, 0 if not ready yet, -1 on error
+  uint8_t data[6];
+  bool error = false;
+
+  if ((_mps != MPS_NONE) && (! command(0xE000))) // Fetch data
+    return -1;
+  if (_wire.requestFrom(_addr, (uint8_t)sizeof(data)) != sizeof(data)) // NACK while no data
+    return 0;
+  for (uint8_t i = 0; i < sizeof(data); ++i) {
+    data[i] = _wire.read();
+  }
+  if (crc8((data[0] << 8) | data[1]) != data[2])
+    error = true;
+  if (temp)
+    *temp = error ? INVALID : toTemperature((data[0] << 8) | data[1]);
+  if (crc8((data[3] << 8) | data[4]) != data[5])
+    error = true;
+  if (hum)
+    *hum = error ? INVALID : toHumidity((data[3] << 8) | data[4]);
+  return error ? -1 : 1;
+}
+
+int8_t SHT3x::read(float *temp, float *hum) {
+  int16_t t, h;
+  int8_t result = read(&t, &h);
+
+  if (result) {
+    if (temp)
+      *temp = (t == INVALID) ? NAN : t / 100.0f;
+    if (hum)
+      *hum = (h == INVALID) ? NAN : h / 100.0f;
+  }
+  return result;
+}
+
+bool SHT3x::measure(int16_t *temp, int16_t *hum) {
+  if (_mps == MPS_NONE) {
+    if (! start())
+      return false;
+    delay(duration());
+  }
+  return read(temp, hum) > 0;
+}
+
+bool SHT3x::measure(float *temp, float *hum) {
+  if (_mps == MPS_NONE) {
+    if (! start())
+      return false;
+    delay(duration());
+  }
+  return read(temp, hum) > 0;
+}
+
+float SHT3x::getTemperature() {
+  float result;
+
+  if (! measure(&result, nullptr))
+    result = NAN;
+  return result;
+}
+
+float SHT3x::getHumidity() {
+  float result;
+
+  if (! measure(nullptr, &result))
+    result = NAN;
+  return result;
+}
+
+uint8_t SHT3x::duration() const {
+  static const uint8_t DURATIONS[] PROGMEM = { 4, 6, 15 }; // Max. conversion time
+
+  return pgm_read_byte(&DURATIONS[_repeat]);
+}
+
+uint16_t SHT3x::period() const {
+  static const uint16_t PERIODS[] PROGMEM = { 2000, 1000, 500, 250, 100, 0 };
+
+  return pgm_read_word(&PERIODS[_mps]);
+}
+
+bool SHT3x::command(uint16_t cmd) {
+  _wire.beginTransmission(_addr);
+  _wire.write(cmd >> 8);
+  _wire.write(cmd & 0xFF);
+  return (_wire.endTransmission() == 0);
+}
+
+uint8_t SHT3x::crc8(uint16_t data) { // Polynomial 0x31, init 0xFF
+  static const uint8_t CRC8_TABLE[256] PROGMEM = {
+    0x00, 0x31, 0x62, 0x53, 0xC4, 0xF5, 0xA6, 0x97, 0xB9, 0x88, 0xDB, 0xEA, 0x7D, 0x4C, 0x1F, 0x2E,
+    0x43, 0x72, 0x21, 0x10, 0x87, 0xB6, 0xE5, 0xD4, 0xFA, 0xCB, 0x98, 0xA9, 0x3E, 0x0F, 0x5C, 0x6D,
+    0x86, 0xB7, 0xE4, 0xD5, 0x42, 0x73, 0x20, 0x11, 0x3F, 0x0E, 0x5D, 0x6C, 0xFB, 0xCA, 0x99, 0xA8,
+    0xC5, 0xF4, 0xA7, 0x96, 0x01, 0x30, 0x63, 0x52, 0x7C, 0x4D, 0x1E, 0x2F, 0xB8, 0x89, 0xDA, 0xEB,
+    0x3D, 0x0C, 0x5F, 0x6E, 0xF9, 0xC8, 0x9B, 0xAA, 0x84, 0xB5, 0xE6, 0xD7, 0x40, 0x71, 0x22, 0x13,
+    0x7E, 0x4F, 0x1C, 0x2D, 0xBA, 0x8B, 0xD8, 0xE9, 0xC7, 0xF6, 0xA5, 0x94, 0x03, 0x32, 0x61, 0x50,
+    0xBB, 0x8A, 0xD9, 0xE8, 0x7F, 0x4E, 0x1D, 0x2C, 0x02, 0x33, 0x60, 0x51, 0xC6, 0xF7, 0xA4, 0x95,
+    0xF8, 0xC9, 0x9A, 0xAB, 0x3C, 0x0D, 0x5E, 0x6F, 0x41, 0x70, 0x23, 0x12, 0x85, 0xB4, 0xE7, 0xD6,
+    0x7A, 0x4B, 0x18, 0x29, 0xBE, 0x8F, 0xDC, 0xED, 0xC3, 0xF2, 0xA1, 0x90, 0x07, 0x36, 0x65, 0x54,
+    0x39, 0x08, 0x5B, 0x6A, 0xFD, 0xCC, 0x9F, 0xAE, 0x80, 0xB1, 0xE2, 0xD3, 0x44, 0x75, 0x26, 0x17,
+    0xFC, 0xCD, 0x9E, 0xAF, 0x38, 0x09, 0x5A, 0x6B, 0x45, 0x74, 0x27, 0x16, 0x81, 0xB0, 0xE3, 0xD2,
+    0xBF, 0x8E, 0xDD, 0xEC, 0x7B, 0x4A, 0x19, 0x28, 0x06, 0x37, 0x64, 0x55, 0xC2, 0xF3, 0xA0, 0x91,
+    0x47, 0x76, 0x25, 0x14, 0x83, 0xB2, 0xE1, 0xD0, 0xFE, 0xCF, 0x9C, 0xAD, 0x3A, 0x0B, 0x58, 0x69,
+    0x04, 0x35, 0x66, 0x57, 0xC0, 0xF1, 0xA2, 0x93, 0xBD, 0x8C, 0xDF, 0xEE, 0x79, 0x48, 0x1B, 0x2A,
+    0xC1, 0xF0, 0xA3, 0x92, 0x05, 0x34, 0x67, 0x56, 0x78, 0x49, 0x1A, 0x2B, 0xBC, 0x8D, 0xDE, 0xEF,
+    0x82, 0xB3, 0xE0, 0xD1, 0x46, 0x77, 0x24, 0x15, 0x3B, 0x0A, 0x59, 0x68, 0xFF, 0xCE, 0x9D, 0xAC
+  };
+
+  return pgm_read_byte(&CRC8_TABLE[pgm_read_byte(&CRC8_TABLE[0xFF ^ (data >> 8)]) ^ (data & 0xFF)]);
+}
@@ -0,0 +1,108 @@
+#include <pgmspace.h>
+#include "WebTemplate.h"
+
+class ChunkPrint : public Print { // Skips first bytes, fills chunk, then carry buffer
+public:
+  ChunkPrint(uint8_t *buffer, size_t size, size_t skip, uint8_t *carry, uint8_t carrySize) : Print(),
+    _buffer(buffer), _size(size), _length(0), _skip(skip), _carry(carry), _carrySize(carrySize), _carried(0), _lost(false) {}
+
+  size_t write(uint8_t c) override {
+    return write(&c, 1);
+  }
+  size_t write(const uint8_t *data, size_t size) override;
+
+  size_t length() const {
+    return _length;
+  }
+  uint8_t carried() const {
+    return _carried;
+  }
+  bool lost() const { // Did not fit chunk and carry buffer
+    return _lost;
+  }
+
+protected:
+  uint8_t *_buffer;
+  size_t _size, _length;
+  size_t _skip;
+  uint8_t *_carry;
+  uint8_t _carrySize, _carried;
+  bool _lost;
+};
+
+size_t ChunkPrint::write(const uint8_t *data, size_t size) {
+  size_t result = size;
+  size_t len;
+
+  if (_skip) {
+    len = _min(_skip, size);
+    _skip -= len;
+    data += len;
+    size -= len;
+  }
+  if (size && (_length < _size)) {
+    len = _min(_size - _length, size);
+    memcpy(&_buffer[_length], data, len);
+    _length += len;
+    data += len;
+    size -= len;
+  }
+  if (size && (_carried < _carrySize)) {
+    len = _min((size_t)(_carrySize - _carried), size);
+    memcpy(&_carry[_carried], data, len);
+    _carried += len;
+    size -= len;
+  }
+  if (size)
+    _lost = true;
+  return result;
+}
+
+WebTemplate::WebTemplate(PGM_P tpl, render_t render, uint32_t data, uint32_t cursor) : _tpl(tpl), _render(render), _data(data),
+  _cursor(cursor), _pos(0), _length(strlen_P(tpl)), _skip(0), _id(0), _carryPos(0), _carryLen(0) {}
+
+size_t WebTemplate::read(uint8_t *buffer, size_t size) {
+  size_t result = 0;
+
+  while (result < size) {
+    if (_carryPos < _carryLen) {
+      size_t len = _min((size_t)(_carryLen - _carryPos), size - result);
+
+      memcpy(&buffer[result], &_carry[_carryPos], len);
+      _carryPos += len;
+      result += len;
+    } else if (_id) {
+      ChunkPrint out(&buffer[result], size - result, _skip, _carry, CARRY_SIZE);
+      uint32_t cursor = _cursor;
+
+      _render(out, _id, _data, cursor);
+      result += out.length();
+      if (out.lost()) { // Chunk is full, render again next time (same part)
+        _skip += out.length();
+        break;
+      }
+      _carryPos = 0;
+      _carryLen = out.carried();
+      _skip = 0;
+      if (cursor != _cursor) // Next part
+        _cursor = cursor;
+      else
+        _id = 0;
+    } else if (_pos < _length) {
+      size_t len = _min((size_t)(_length - _pos), size - result);
+      const uint8_t *marker;
+
+      memcpy_P(&buffer[result], &_tpl[_pos], len);
+      if ((marker = (const uint8_t*)memchr(&buffer[result], MARKER, len))) {
+        len = marker - &buffer[result];
+        if (_pos + len + 1 < _length)
+          _id = pgm_read_byte(&_tpl[_pos + len + 1]);
+        _pos += 2;
+      }
+      _pos += len;
+      result += len;
+    } else
+      break;
+  }
+  return result;
+}
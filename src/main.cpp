@@ -1,10 +1,12 @@
 #define USE_SERIAL
 #define USE_LLMNR
 #define USE_SHT3X
+#define USE_STATS
 
 #define LED_PIN   2
 #define LED_LEVEL LOW
 
+#include <memory>
 #include <pgmspace.h>
 #include <Arduino.h>
 #include <FS.h>
@@ -23,12 +25,17 @@
 #include "Leds.h"
 #endif
 #include "HtmlHelper.h"
+#include "WebTemplate.h"
+#include "Json.h"
 #include "Ntp.h"
 #include "ActionQueue.h"
+#include "Task.h"
 #include "MAX7219.h"
 #include "Date.h"
 #ifdef USE_SHT3X
 #include "SHT3x.h"
+#include "SensorFilter.h"
+#include "History.h"
 #endif
 
 #ifdef LED_PIN
@@ -54,9 +61,30 @@
 //#define DEF_NTP_TZ      3
 #define DEF_NTP_INTERVAL  (3600 * 4)
 
+#define LOG_FILE      "/log.txt"
+#define LOG_FILE_OLD  "/log.1.txt"
+#define WEB_DIR       "/www" // Only web assets (stored by gzip_web.py) are served, not log, history or config
+
 const uint8_t RST_CP = 3; // Reboot count to launch captive portal
 const uint8_t RST_RESET = 5; // Reboot count to clear configuration
 
+const uint8_t RTC_RST_OFFSET = 32; // Reboot counter position in RTC user memory (in 4-byte blocks, first 128 bytes hold eboot OTA command)
+const uint8_t RTC_NTP_OFFSET = 34; // Last known time position in RTC user memory (in 4-byte blocks)
+const uint32_t RTC_NTP_PERIOD = 60000; // Last known time checkpoint period (60 sec.)
+const uint8_t RTC_LOG_OFFSET = 42; // Log tail position in RTC user memory (in 4-byte blocks)
+const uint16_t RTC_LOG_SIZE = 344; // Log tail size in RTC user memory (up to the end of 512 bytes)
+const uint32_t LOG_SAVE_PERIOD = 5000; // Log tail checkpoint period (5 sec.)
+const uint32_t LOG_FILE_PERIOD = 60000; // Minimal interval between log file writes (60 sec.)
+const size_t LOG_FILE_SIZE = 16384; // Log file is rotated when exceeds
+const uint16_t LOG_EVENT_SIZE = 512; // Formatted log text per event (at most)
+const uint16_t LOG_EVENT_BACKLOG = 2048; // Stored log bytes a client may be behind, older ones are dropped
+const uint8_t LOG_EVENT_QUEUE = 4; // New log records wait while clients have more unsent events (on average)
+const uint32_t LOG_EVENT_PERIOD = 250; // 250 ms.
+const uint8_t LOG_EVENT_CONNECTS = 4; // Event clients connecting at once
+#ifdef USE_SHT3X
+const uint32_t HISTORY_SAVE_PERIOD = 600000; // Unfinished history blocks checkpoint period (10 min.)
+#endif
+
 static const char PARAM_WIFI_SSID[] PROGMEM = "wifi_ssid";
 static const char PARAM_WIFI_PSWD[] PROGMEM = "wifi_pswd";
 static const char PARAM_ADM_NAME[] PROGMEM = "adm_name";
@@ -80,6 +108,19 @@ static const char URL_OTA[] PROGMEM = "/ota";
 static const char URL_WIFI[] PROGMEM = "/wifi";
 static const char URL_NTP[] PROGMEM = "/ntp";
 static const char URL_LOG[] PROGMEM = "/log";
+static const char URL_LOG_EVENTS[] PROGMEM = "/logstream"; // Not under "/log", it would be caught by log page handler
+static const char URL_CONFIG[] PROGMEM = "/config";
+#ifdef USE_SHT3X
+static const char URL_HISTORY[] PROGMEM = "/history";
+#endif
+#ifdef USE_STATS
+static const char URL_STATS[] PROGMEM = "/stats";
+#endif
+static const char URL_API_STATUS[] PROGMEM = "/api/status";
+static const char URL_API_CONFIG[] PROGMEM = "/api/config";
+#ifdef USE_SHT3X
+static const char URL_API_SENSOR[] PROGMEM = "/api/sensor";
+#endif
 
 const uint8_t TEXT_SIZE = 16;
 
@@ -101,7 +142,53 @@ struct __attribute__((__packed__)) config_t {
   uint8_t evening_bright;
 };
 
-Parameters<config_t> config;
+const uint16_t CONFIG_VERSION = 1;
+
+static const param_field_t CONFIG_FIELDS[] PROGMEM = { // Field ids must never change
+  PARAM_FIELD(1, FIELD_STR, config_t, wifi_ssid),
+  PARAM_FIELD(2, FIELD_STR, config_t, wifi_pswd),
+  PARAM_FIELD(3, FIELD_STR, config_t, adm_name),
+  PARAM_FIELD(4, FIELD_STR, config_t, adm_pswd),
+#ifdef USE_LLMNR
+  PARAM_FIELD(5, FIELD_STR, config_t, llmnr_name),
+#endif
+  PARAM_FIELD(6, FIELD_STR, config_t, ntp_server),
+  PARAM_FIELD(7, FIELD_INT, config_t, ntp_tz),
+  PARAM_FIELD(8, FIELD_UINT, config_t, ntp_interval),
+  PARAM_FIELD(9, FIELD_STR, config_t, greetings),
+  PARAM_FIELD(10, FIELD_UINT, config_t, morning_hour),
+  PARAM_FIELD(11, FIELD_UINT, config_t, morning_bright),
+  PARAM_FIELD(12, FIELD_UINT, config_t, evening_hour),
+  PARAM_FIELD(13, FIELD_UINT, config_t, evening_bright)
+};
+
+Parameters<config_t> config(CONFIG_FIELDS, sizeof(CONFIG_FIELDS) / sizeof(CONFIG_FIELDS[0]), CONFIG_VERSION);
+
+struct api_field_t { // Configuration field in REST API
+  uint8_t id; // In CONFIG_FIELDS
+  PGM_P name; // Same as form parameter
+  int32_t min; // Range of integer value
+  int32_t max;
+  bool secret; // Write only
+};
+
+static const api_field_t API_FIELDS[] PROGMEM = {
+  { 1, PARAM_WIFI_SSID, 0, 0, false },
+  { 2, PARAM_WIFI_PSWD, 0, 0, true },
+  { 3, PARAM_ADM_NAME, 0, 0, false },
+  { 4, PARAM_ADM_PSWD, 0, 0, true },
+#ifdef USE_LLMNR
+  { 5, PARAM_LLMNR_NAME, 0, 0, false },
+#endif
+  { 6, PARAM_NTP_SERVER, 0, 0, false },
+  { 7, PARAM_NTP_TZ, -11, 13, false },
+  { 8, PARAM_NTP_INTERVAL, 0, 65535, false },
+  { 9, PARAM_GREETINGS, 0, 0, false },
+  { 10, PARAM_MORNING_HOUR, 0, 23, false },
+  { 11, PARAM_MORNING_BRIGHT, 0, 15, false },
+  { 12, PARAM_EVENING_HOUR, 0, 23, false },
+  { 13, PARAM_EVENING_BRIGHT, 0, 15, false }
+};
 #ifdef USE_SERIAL
 Logger<> logger(&Serial);
 #else
@@ -109,27 +196,88 @@ Logger<> logger();
 #endif
 #ifdef LED_PIN
 Leds<1> led;
+
+static const decltype(led)::keyframe_t LED_NTP_PATTERN[] PROGMEM = { // Double blink
+  { 255, 50, false }, { 0, 150, false }, { 255, 50, false }, { 0, 1750, false }, { 0, 0, false }
+};
+static const decltype(led)::keyframe_t LED_ERROR_PATTERN[] PROGMEM = { // Triple blink with fade out
+  { 255, 50, false }, { 0, 150, false }, { 255, 50, false }, { 0, 150, false }, { 255, 300, true }, { 0, 1300, false }, { 0, 0, false }
+};
 #endif
 Ticker wifiTimer;
 AsyncWebServer http(80);
+AsyncEventSource logEvents(FPSTR(URL_LOG_EVENTS));
+uint32_t logStreamed = 0; // Log position sent to all event clients
+struct log_connect_t { // Log position to start connecting event client from, passed from request filter to connect callback
+  const AsyncClient *client;
+  uint32_t since;
+};
+log_connect_t logConnects[LOG_EVENT_CONNECTS];
+uint8_t logConnectNext = 0; // Slot reused if all are taken
+uint32_t logDropped = 0; // Stored log bytes not sent to some event client
 #ifdef USE_SHT3X
-ActionQueue<2> actions;
+const uint8_t MAX_ACTIONS = 8;
 #else
-ActionQueue<1> actions;
+const uint8_t MAX_ACTIONS = 6;
+#endif
+ActionQueue<MAX_ACTIONS> actions;
+#ifdef USE_SERIAL
+ActionQueue<MAX_ACTIONS>::handle_t logFlusher = ActionQueue<MAX_ACTIONS>::INVALID_HANDLE;
 #endif
 MAX7219<D8, 4> display;
 #ifdef USE_SHT3X
-SHT3x<> *sht = nullptr;
-float temp = NAN;
-float hum = NAN;
+const uint8_t MAX_SENSORS = 2; // Inside and outside
+
+struct sensor_t {
+  SensorFilter<> temp; // Filtered, in 0.01 C
+  SensorFilter<> hum; // Filtered, in 0.01 %
+  uint32_t errors;
+};
+
+SHT3xGroup<MAX_SENSORS> sht;
+sensor_t sensors[MAX_SENSORS];
+History history; // Of first sensor
+#endif
+#ifdef USE_STATS
+TaskStats renderStats;
+TaskStats scrollStats;
 #endif
 volatile bool restarting = false;
+uint32_t logArchived = 0; // Log position already in log file
+
+static bool logArchive() { // Append records stored since last call to log file
+  if (logger.position() != logArchived) {
+    File file = LittleFS.open(LOG_FILE, "a");
+    size_t size;
+
+    if (! file)
+      return false;
+    logger.forEach([&file](const char *data, uint16_t len) {
+      file.write((const uint8_t*)data, len);
+    }, logArchived);
+    size = file.size();
+    file.close();
+    logArchived = logger.position();
+    if (size > LOG_FILE_SIZE) {
+      LittleFS.remove(LOG_FILE_OLD);
+      LittleFS.rename(LOG_FILE, LOG_FILE_OLD);
+    }
+    return true;
+  }
+  return false;
+}
 
 static void halt(const __FlashStringHelper *msg = nullptr) {
+  logger.rtcSave(RTC_LOG_OFFSET, RTC_LOG_SIZE);
+  logArchive();
+#ifdef USE_SHT3X
+  history.flush();
+#endif
 #ifdef LED_PIN
   led.setMode(0, led.LED_OFF);
 #endif
 #ifdef USE_SERIAL
+  logger.flush();
   if (msg)
     Serial.println(msg);
   Serial.flush();
@@ -138,10 +286,17 @@ static void halt(const __FlashStringHelper *msg = nullptr) {
 }
 
 static void restart(const __FlashStringHelper *msg = nullptr) {
+  ntpSave(RTC_NTP_OFFSET);
+  logger.rtcSave(RTC_LOG_OFFSET, RTC_LOG_SIZE);
+  logArchive();
+#ifdef USE_SHT3X
+  history.flush();
+#endif
 #ifdef LED_PIN
   led.setMode(0, led.LED_OFF);
 #endif
 #ifdef USE_SERIAL
+  logger.flush();
   if (msg)
     Serial.println(msg);
   Serial.flush();
@@ -160,6 +315,52 @@ static const char *strOrNull(const char *str) {
   return nullptr;
 }
 
+#ifdef USE_SHT3X
+static uint8_t centiToStr(char *str, int16_t value) { // Hundredths to string with one decimal
+  int16_t tenths = (value + (value < 0 ? -5 : 5)) / 10;
+
+  return sprintf_P(str, PSTR("%s%u.%u"), (tenths < 0) ? "-" : "", abs(tenths) / 10, abs(tenths) % 10);
+}
+
+static void printStats(Print *out, const SensorFilter<> &filter, SensorFilter<>::window_t window) { // "min/mean/max"
+  char str[8];
+
+  centiToStr(str, filter.min(window));
+  out->print(str);
+  out->print('/');
+  centiToStr(str, filter.mean(window));
+  out->print(str);
+  out->print('/');
+  centiToStr(str, filter.max(window));
+  out->print(str);
+}
+
+static bool sensorValid(uint8_t index) {
+  return (sensors[index].temp.value() != SHT3x::INVALID) && (sensors[index].hum.value() != SHT3x::INVALID);
+}
+
+static int8_t sensorShown(uint8_t sec) { // Sensor to scroll at this second (10..19 first one, 30..39 next one) or -1
+  int8_t index;
+
+  if ((! sht.count()) || (! (((sec >= 10) && (sec < 20)) || ((sec >= 30) && (sec < 40)))))
+    return -1;
+  index = (sec >= 30) ? 1 % sht.count() : 0;
+  return sensorValid(index) ? index : -1;
+}
+
+static uint8_t sensorToStr(char *str, uint8_t index, PGM_P degree) { // "t<degree> h%"
+  uint8_t len = centiToStr(str, sensors[index].temp.value());
+
+  strcpy_P(&str[len], degree);
+  len += strlen(&str[len]);
+  str[len++] = ' ';
+  len += centiToStr(&str[len], sensors[index].hum.value());
+  str[len++] = '%';
+  str[len] = '\0';
+  return len;
+}
+#endif
+
 static void wifiConnect() {
   static const uint8_t PROGRESS[] PROGMEM = {
     0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
@@ -193,7 +394,7 @@ static void wifiOnEvent(WiFiEvent_t event) {
         display.noAnimate();
         display.clear();
       }
-      logger.println(F("WiFi disconnected"));
+      logger.event_P(PSTR("WiFi disconnected"));
       if (! restarting)
         wifiTimer.once_ms(5000, wifiConnect);
       http.end();
@@ -211,22 +412,27 @@ static void wifiOnEvent(WiFiEvent_t event) {
         display.endUpdate();
       }
       wifiTimer.detach();
-      logger.print(F("WiFi connected (IP "));
-      logger.print(WiFi.localIP());
-      logger.println(')');
+      {
+        IPAddress ip = WiFi.localIP();
+
+        logger.event_P(PSTR("WiFi connected (IP %u.%u.%u.%u)"), ip[0], ip[1], ip[2], ip[3]);
+      }
       http.begin();
 #ifdef LED_PIN
-      led.setMode(0, led.LED_IDLE);
+      if (ntpTime() || (! *config->ntp_server)) // Time is known or will never be
+        led.setMode(0, led.LED_IDLE);
+      else
+        led.setPattern(0, LED_NTP_PATTERN);
 #endif
       break;
     case WIFI_EVENT_SOFTAPMODE_STACONNECTED:
-      logger.println(F("New AP client connected"));
+      logger.event_P(PSTR("New AP client connected"));
 #ifdef LED_PIN
       led.setMode(0, led.LED_CP1);
 #endif
       break;
     case WIFI_EVENT_SOFTAPMODE_STADISCONNECTED:
-      logger.println(F("AP client disconnected"));
+      logger.event_P(PSTR("AP client disconnected"));
 #ifdef LED_PIN
       if (! WiFi.softAPgetStationNum())
         led.setMode(0, led.LED_CP0);
@@ -237,10 +443,22 @@ static void wifiOnEvent(WiFiEvent_t event) {
   }
 }
 
-static size_t encodeString(Print *out, const char *str, uint16_t len = 0) {
+static size_t encodeString(Print *out, const char *str, uint16_t len = 0) { // Runs of plain characters are written at once
+  static const uint32_t SPECIAL[8] = { 0x00000001, 0x500000C4, 0, 0, 0, 0, 0, 0 }; // Bit per character: '\0', '"', '&', '\'', '<', '>'
+
+  const char *end = len ? str + len : nullptr;
   size_t result = 0;
 
-  while (*str) {
+  while (true) {
+    const char *run = str;
+    uint8_t c;
+
+    while ((str != end) && (! (SPECIAL[(c = *str) >> 5] & (1UL << (c & 0x1F)))))
+      ++str;
+    if (str > run)
+      result += out->write((const uint8_t*)run, str - run);
+    if ((str == end) || (! *str))
+      break;
     if (*str == '\'')
       result += out->print(F("&apos;"));
     else if (*str == '"')
@@ -249,14 +467,8 @@ static size_t encodeString(Print *out, const char *str, uint16_t len = 0) {
       result += out->print(F("&lt;"));
     else if (*str == '>')
       result += out->print(F("&gt;"));
-    else if (*str == '&')
-      result += out->print(F("&amp;"));
     else
-      result += out->print(*str);
-    if (len) {
-      if (! --len)
-        break;
-    }
+      result += out->print(F("&amp;"));
     ++str;
   }
   return result;
@@ -271,32 +483,291 @@ static bool isEvening(uint8_t h) {
 }
 
 static uint32_t ntpUpdating() {
-  if (*config->ntp_server) {
-    if (ntpUpdate(config->ntp_server, config->ntp_tz)) {
-      logger.println(F("NTP update successful"));
+  const uint8_t NTP_REPEAT = 2;
+
+  static Task task;
+  static uint8_t repeat;
+  static int8_t result;
+
+  TASK_BEGIN(task);
+  while (*config->ntp_server) {
+    result = -1;
+    for (repeat = 0; repeat < NTP_REPEAT; ++repeat) {
+      if (ntpRequest(config->ntp_server)) {
+        TASK_AWAIT(task, (result = ntpCheck(config->ntp_tz)) != 0, 10);
+        if (result > 0)
+          break;
+      }
+    }
+    if (result > 0) {
+      logger.event_P(PSTR("NTP update successful"));
+      ntpSave(RTC_NTP_OFFSET);
+#ifdef LED_PIN
+      led.setMode(0, led.LED_IDLE);
+#endif
       if (isEvening((ntpTime() / 3600) % 24))
         display.setBrightness(config->evening_bright);
       else
         display.setBrightness(config->morning_bright);
-      return config->ntp_interval * 1000;
-    } else
-      return 5000; // 5 sec. to retry
-  } else // Remove action
-    return 0;
+      if (! config->ntp_interval) // Remove action
+        break;
+      TASK_DELAY(task, config->ntp_interval * 1000);
+    } else {
+#ifdef LED_PIN
+      if (WiFi.isConnected())
+        led.setPattern(0, LED_ERROR_PATTERN);
+#endif
+      TASK_DELAY(task, 5000); // 5 sec. to retry
+    }
+  }
+  TASK_END(task);
 }
 
-#ifdef USE_SHT3X
-static uint32_t shtUpdating() {
-  if (sht) {
-    if (! sht->measure(&temp, &hum)) {
-      logger.println(F("SHT3x read error!"));
+#ifdef USE_SERIAL
+static uint32_t logFlushing() {
+  const uint32_t LOG_FLUSH_IDLE = 3600000; // Woken by logQueued()
+
+  logger.loop();
+  return logger.pending() ? 5 : LOG_FLUSH_IDLE; // UART FIFO (128 B) is sent in 11 ms. at 115200 baud
+}
+
+static void logQueued() {
+  actions.reschedule(logFlusher, 5);
+}
+#endif
+
+static uint32_t ntpSaving() {
+  ntpSave(RTC_NTP_OFFSET);
+  return RTC_NTP_PERIOD;
+}
+
+static uint32_t logSaving() {
+  static uint32_t saved = 0;
+  static uint32_t archived = 0;
+
+  if (logger.position() != saved) { // Tail for WDT resets not caught by crash callback
+    logger.rtcSave(RTC_LOG_OFFSET, RTC_LOG_SIZE);
+    saved = logger.position();
+  }
+  if ((millis() - archived >= LOG_FILE_PERIOD) && logArchive())
+    archived = millis();
+  return LOG_SAVE_PERIOD;
+}
+
+static uint32_t logSend(AsyncEventSourceClient *client, uint32_t since, uint32_t until) { // One event of whole records to client (all if nullptr), returns position after them
+  static char buf[LOG_EVENT_SIZE + 1]; // Not on stack, also used from network callbacks
+  uint16_t len = 0;
+  bool full = false;
+
+  while ((since != until) && (! full)) {
+    uint32_t next = logger.next(since);
+    uint16_t start = len;
+
+    if ((int32_t)(next - until) > 0)
+      next = until;
+    logger.forEach([&len, &full](const char *data, uint16_t size) {
+      while (size--) {
+        if (*data == '\r') { // Lines are separated by '\n' in event data
+          ++data;
+        } else if (len < LOG_EVENT_SIZE) {
+          buf[len++] = *data++;
+        } else {
+          full = true;
+          break;
+        }
+      }
+    }, since, next);
+    if (full && start) { // Record goes to next event (first one is truncated)
+      len = start;
+      full = false;
+      break;
+    }
+    since = next;
+  }
+  if (len) {
+    bool line = full || (buf[len - 1] == '\n'); // Event data can not end with line break, so event type tells it
+
+    if (line)
+      --len;
+    buf[len] = '\0';
+    if (client)
+      client->send(buf, line ? "log" : "text", since);
+    else
+      logEvents.send(buf, line ? "log" : "text", since);
+  }
+  return since;
+}
+
+static uint32_t logSkip(AsyncEventSourceClient *client, uint32_t since) { // Position of records to send to client (all if nullptr), the ones evicted or beyond backlog are dropped
+  uint32_t dropped = 0;
+
+  if ((int32_t)(logger.position() - logger.length() - since) > 0) { // Already evicted
+    dropped = logger.position() - logger.length() - since;
+    since = logger.position() - logger.length();
+  }
+  while (logger.position() - since > LOG_EVENT_BACKLOG) {
+    uint32_t next = logger.next(since);
+
+    dropped += next - since;
+    since = next;
+  }
+  if (dropped) {
+    char str[11];
+
+    logDropped += dropped;
+    utoa(dropped, str, 10);
+    if (client)
+      client->send(str, "dropped", since);
+    else
+      logEvents.send(str, "dropped", since);
+  }
+  return since;
+}
+
+static void logBroadcast(bool all) { // New records to all event clients, they wait in log while clients are behind
+  if (! logEvents.count()) {
+    logStreamed = logger.position();
+  } else if (all || (logEvents.avgPacketsWaiting() < LOG_EVENT_QUEUE)) {
+    logStreamed = logSkip(nullptr, logStreamed);
+    for (uint8_t i = 0; (all || (i < LOG_EVENT_QUEUE)) && (logStreamed != logger.position()); ++i) {
+      logStreamed = logSend(nullptr, logStreamed, logger.position());
+    }
+  }
+}
+
+static uint32_t logStreaming() {
+  logBroadcast(false);
+  return LOG_EVENT_PERIOD;
+}
+
+static bool logEventsFilter(AsyncWebServerRequest *request) { // Called before event client is created (and connected)
+  if (request->url().equals(FPSTR(URL_LOG_EVENTS))) {
+    AsyncWebHeader *header = request->getHeader(F("Last-Event-ID")); // Reconnect
+    uint8_t slot = LOG_EVENT_CONNECTS;
+    uint32_t since = logger.position() - logger.length(); // Whole log by default
+
+    if (header)
+      since = strtoul(header->value().c_str(), nullptr, 10);
+    else if (request->hasParam(F("since"))) // Log page was rendered up to
+      since = strtoul(request->getParam(F("since"))->value().c_str(), nullptr, 10);
+    if ((int32_t)(since - logger.position()) > 0) // From future
+      since = logger.position();
+    for (uint8_t i = 0; i < LOG_EVENT_CONNECTS; ++i) {
+      if (logConnects[i].client == request->client()) { // Same connection
+        slot = i;
+        break;
+      }
+      if ((! logConnects[i].client) && (slot == LOG_EVENT_CONNECTS))
+        slot = i;
     }
-    return 2000; // 2 sec.
-  } else // Remove action
+    if (slot == LOG_EVENT_CONNECTS) { // All taken by clients that did not connect
+      slot = logConnectNext;
+      logConnectNext = (logConnectNext + 1) % LOG_EVENT_CONNECTS;
+    }
+    logConnects[slot].client = request->client();
+    logConnects[slot].since = since;
+    logBroadcast(true); // Others are up to date, so new client gets backlog up to logStreamed and the rest with them
+  }
+  return true;
+}
+
+static void logEventsConnect(AsyncEventSourceClient *client) {
+  uint32_t since = logger.position() - logger.length();
+
+  for (uint8_t i = 0; i < LOG_EVENT_CONNECTS; ++i) {
+    if (logConnects[i].client == client->client()) { // Set by filter for its request
+      since = logConnects[i].since;
+      logConnects[i].client = nullptr;
+      break;
+    }
+  }
+  since = logSkip(client, since);
+  while (since != logStreamed) {
+    since = logSend(client, since, logStreamed);
+  }
+}
+
+extern "C" void custom_crash_callback(struct rst_info *rst_info, uint32_t stack, uint32_t stack_end) { // Exception or soft WDT
+  ntpSave(RTC_NTP_OFFSET);
+  logger.rtcSave(RTC_LOG_OFFSET, RTC_LOG_SIZE);
+}
+
+#ifdef USE_SHT3X
+static uint32_t shtUpdating() { // Trigger all sensors together, then fetch all results in one pass
+  const uint32_t PERIOD = 2000; // 2 sec.
+  const uint8_t RETRY = 2; // Poll interval while conversion is not over (in ms.)
+  const uint8_t MAX_RETRIES = 5;
+
+  static int16_t temps[MAX_SENSORS], hums[MAX_SENSORS]; // Kept between polls
+  static uint8_t wait = 0; // Conversion time of pending pass, 0 if not triggered
+  static uint8_t retries;
+
+  if (! sht.count()) // Remove action
     return 0;
+  if (! wait) {
+    for (uint8_t i = 0; i < MAX_SENSORS; ++i) {
+      temps[i] = hums[i] = SHT3x::INVALID; // Stays for sensor failed to start
+    }
+    wait = sht.start() + 1;
+    retries = 0;
+    return wait | ACTION_FROM_NOW; // After trigger, not after deadline
+  } else {
+    uint32_t result;
+
+    if (sht.read(temps, hums) && (retries < MAX_RETRIES)) { // Not ready is not an error yet
+      ++retries;
+      return RETRY | ACTION_FROM_NOW;
+    }
+    result = PERIOD - wait - retries * RETRY;
+    for (uint8_t i = 0; i < sht.count(); ++i) {
+      if ((temps[i] == SHT3x::INVALID) || (hums[i] == SHT3x::INVALID)) {
+        ++sensors[i].errors;
+        logger.event_P(PSTR("SHT3x #%u read error #%u!"), i + 1, sensors[i].errors);
+      } else {
+        sensors[i].temp.add(temps[i]);
+        sensors[i].hum.add(hums[i]);
+      }
+    }
+    history.add(ntpTime(), sensors[0].temp.value(), sensors[0].hum.value());
+    wait = 0;
+    return result;
+  }
+}
+
+static uint32_t historySaving() { // Unfinished blocks of coarse tiers take hours to fill
+  if (! history.save())
+    logger.println(F("History save fail!"));
+  return HISTORY_SAVE_PERIOD;
 }
 #endif
 
+static void printInput(Print &out, PGM_P name, const char *value, size_t size) { // Attributes of text input for config string
+  out.print(F("name='"));
+  out.print(FPSTR(name));
+  out.print(F("' value='"));
+  encodeString(&out, value);
+  out.print(F("' size="));
+  out.print(_min(TEXT_SIZE, size - 1));
+  out.print(F(" maxlength="));
+  out.print(size - 1);
+}
+
+static void printNumber(Print &out, PGM_P name, int32_t value) { // Attributes of number input
+  out.print(F("name='"));
+  out.print(FPSTR(name));
+  out.print(F("' value='"));
+  out.print(value);
+  out.print('\'');
+}
+
+static void webSendTemplate(AsyncWebServerRequest *request, PGM_P tpl, WebTemplate::render_t render, uint32_t data = 0, uint32_t cursor = 0) { // Chunked, straight from flash
+  std::shared_ptr<WebTemplate> page = std::make_shared<WebTemplate>(tpl, render, data, cursor); // Freed with response
+
+  request->send(request->beginChunkedResponse(FPSTR(TEXT_HTML), [page](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+    return page->read(buffer, maxLen);
+  }));
+}
+
 static bool webAuthorize(AsyncWebServerRequest *request) {
   if ((WiFi.getMode() == WIFI_STA) && *config->adm_name && *config->adm_pswd) {
     if (! request->authenticate(config->adm_name, config->adm_pswd)) {
@@ -307,7 +778,52 @@ static bool webAuthorize(AsyncWebServerRequest *request) {
   return true;
 }
 
+static bool webStatic(AsyncWebServerRequest *request) { // Gzipped file from web directory of LittleFS, false if not found
+  String path = String(F(WEB_DIR)) + request->url();
+  AsyncWebHeader *header;
+  AsyncWebServerResponse *response;
+  File file;
+  uint32_t trailer[2]; // CRC32 and size of uncompressed content
+  char etag[24];
+  bool versioned;
+
+  if ((request->method() != HTTP_GET) || (path.indexOf(F("/.")) >= 0)) // Hidden files (e.g. config journal with passwords) are private
+    return false;
+  if (path.endsWith(F("/")))
+    path += F("index.html");
+  file = LittleFS.open(path + F(".gz"), "r"); // gzip_web.py stores compressed files only
+  if ((! file) || file.isDirectory())
+    return false;
+  header = request->getHeader(F("Accept-Encoding"));
+  if ((! header) || (header->value().indexOf(F("gzip")) < 0)) { // No plain variant
+    file.close();
+    request->send(406);
+    return true;
+  }
+  if ((file.size() < 18) || (! file.seek(file.size() - sizeof(trailer))) || (file.read((uint8_t*)trailer, sizeof(trailer)) != sizeof(trailer)) ||
+    (! file.seek(0))) { // Not a gzip file
+    file.close();
+    return false;
+  }
+  sprintf_P(etag, PSTR("\"%08x-%x\""), trailer[0], trailer[1]); // Content hash (file time is never set)
+  versioned = request->hasParam(F("v")); // Asset URL changes with content (e.g. "app.js?v=2")
+  header = request->getHeader(F("If-None-Match"));
+  if (header && header->value().equals(etag)) {
+    file.close();
+    response = request->beginResponse(304);
+  } else {
+    response = request->beginResponse(file, path); // Sets Content-Encoding for ".gz" file
+  }
+  response->addHeader(F("ETag"), etag);
+  response->addHeader(F("Cache-Control"), versioned ? F("public, max-age=31536000, immutable") : F("no-cache"));
+  response->addHeader(F("Vary"), F("Accept-Encoding"));
+  request->send(response);
+  return true;
+}
+
 static void webNotFound(AsyncWebServerRequest *request) {
+  if (webStatic(request))
+    return;
   if ((WiFi.getMode() == WIFI_AP) && (! request->host().equals(WiFi.softAPIP().toString()))) { // Captive portal
     request->redirect(String(F("http://")) + WiFi.softAPIP().toString());
   } else {
@@ -315,56 +831,123 @@ static void webNotFound(AsyncWebServerRequest *request) {
   }
 }
 
-static void webRoot(AsyncWebServerRequest *request) {
-  AsyncResponseStream *response = request->beginResponseStream(FPSTR(TEXT_HTML));
-
-//  response->setCode(200);
-  response->print(FPSTR(HTML_PAGE_START));
-  response->print(F("WiFi Clock"));
-  response->print(FPSTR(HTML_PAGE_CONT));
-  response->print(FPSTR(HTML_STYLE_START));
-  response->print(F("body{background-color:#eee}\n"
-    "a{text-decoration:none;color:black;border:1px solid black;border-radius:10px 25px;padding:8px 16px}\n"));
-  response->print(FPSTR(HTML_STYLE_END));
-  response->print(FPSTR(HTML_BODY));
-  response->print(F("<h1>WiFi Clock</h1>\n"
-    "Uptime: "));
-  response->print(millis() / 1000);
-  response->print(F(" sec.</br>\n"
-    "Free heap: "));
-  response->print(ESP.getFreeHeap());
-  response->print(F(" bytes</br>\n"));
 #ifdef USE_SHT3X
-  if (sht && (! isnan(temp)) && (! isnan(hum))) {
-    response->printf_P(PSTR("SHT3x: %0.1f&deg; %0.1f%%</br>\n"), temp, hum);
+static void renderSensors(Print &out, uint32_t &cursor) { // Part per call, none longer than WebTemplate::CARRY_SIZE, so live values are never printed twice into one page
+  static const char WINDOWS[3][5] PROGMEM = { "1 m", "1 h", "24 h" };
+  const uint8_t PARTS = 3 + 3 * 3; // Header, values, errors, then name, temperature and humidity of each window
+
+  uint8_t i = cursor / PARTS;
+  uint8_t part = cursor % PARTS;
+
+  if (! part) {
+    while ((i < sht.count()) && (! sensorValid(i)))
+      ++i;
+  }
+  if (i >= sht.count()) // End
+    return;
+  if (part == 0) {
+    out.printf_P(PSTR("SHT3x #%u (0x%02X): "), i + 1, sht[i].address());
+  } else if (part == 1) {
+    char str[24];
+
+    sensorToStr(str, i, PSTR("&deg;"));
+    out.print(str);
+  } else if (part == 2) {
+    out.print(F(" (errors: "));
+    out.print(sensors[i].errors);
+    out.print(F(")</br>\n"));
+  } else {
+    SensorFilter<>::window_t w = (SensorFilter<>::window_t)((part - 3) / 3);
+
+    if ((part - 3) % 3 == 0) {
+      out.print(FPSTR(WINDOWS[w]));
+      out.print(F(" min/avg/max: "));
+    } else if ((part - 3) % 3 == 1) {
+      printStats(&out, sensors[i].temp, w);
+      out.print(F("&deg; "));
+    } else {
+      printStats(&out, sensors[i].hum, w);
+      out.print(F("%</br>\n"));
+    }
   }
+  cursor = i * PARTS + part + 1;
+}
+#endif
+
+static void renderRoot(Print &out, char id, uint32_t data, uint32_t &cursor) {
+  switch (id) {
+    case 'u':
+      out.print(millis() / 1000);
+      break;
+    case 'h':
+      out.print(ESP.getFreeHeap());
+      break;
+    case 't':
+      if (ntpTime()) {
+        out.print(F("Time accuracy: &plusmn;"));
+        out.print(ntpError());
+        out.print(F(" ms</br>\n"));
+      }
+      break;
+#ifdef USE_SHT3X
+    case 's':
+      renderSensors(out, cursor);
+      break;
+#endif
+    case 'n':
+      out.print(F("<a href='"));
+      out.print(FPSTR(URL_WIFI));
+      out.print(F("'>WiFi</a>\n"
+        "<a href='"));
+      out.print(FPSTR(URL_NTP));
+      out.print(F("'>NTP</a>\n"
+        "<a href='"));
+      out.print(FPSTR(URL_LOG));
+      out.print(F("'>Log</a>\n"));
+#ifdef USE_SHT3X
+      if (sht.count()) {
+        out.print(F("<a href='"));
+        out.print(FPSTR(URL_HISTORY));
+        out.print(F("'>History</a>\n"));
+      }
 #endif
-  response->print(F("<p>\n"
-    "<a href='"));
-  response->print(FPSTR(URL_WIFI));
-  response->print(F("'>WiFi</a>\n"
-    "<a href='"));
-  response->print(FPSTR(URL_NTP));
-  response->print(F("'>NTP</a>\n"
-    "<a href='"));
-  response->print(FPSTR(URL_LOG));
-  response->print(F("'>Log</a>\n"));
 /*
-  response->print(F("<a href='"));
-  response->print(FPSTR(URL_RESET));
-  response->print('\'');
-  if (WiFi.getMode() == WIFI_STA)
-    response->print(F(" onclick='if(!confirm(\"Are you sure?\")) return false'"));
-  response->print(F(">Reset!</a>\n"));
+      out.print(F("<a href='"));
+      out.print(FPSTR(URL_RESET));
+      out.print('\'');
+      if (WiFi.getMode() == WIFI_STA)
+        out.print(F(" onclick='if(!confirm(\"Are you sure?\")) return false'"));
+      out.print(F(">Reset!</a>\n"));
 */
-  response->print(F("<a href='"));
-  response->print(FPSTR(URL_RESTART));
-  response->print('\'');
-  if (WiFi.getMode() == WIFI_STA)
-    response->print(F(" onclick='if(!confirm(\"Are you sure?\")) return false'"));
-  response->print(F(">Restart!</a>\n"));
-  response->print(FPSTR(HTML_PAGE_END));
-  request->send(response);
+      out.print(F("<a href='"));
+      out.print(FPSTR(URL_RESTART));
+      out.print('\'');
+      if (WiFi.getMode() == WIFI_STA)
+        out.print(F(" onclick='if(!confirm(\"Are you sure?\")) return false'"));
+      out.print(F(">Restart!</a>\n"));
+      break;
+  }
+}
+
+static void webRoot(AsyncWebServerRequest *request) {
+  static const char PAGE[] PROGMEM = HTML_PAGE_START_STR "WiFi Clock" HTML_PAGE_CONT_STR
+    HTML_STYLE_START_STR
+    "body{background-color:#eee}\n"
+    "a{text-decoration:none;color:black;border:1px solid black;border-radius:10px 25px;padding:8px 16px}\n"
+    HTML_STYLE_END_STR
+    HTML_BODY_STR
+    "<h1>WiFi Clock</h1>\n"
+    "Uptime: " TPL("u") " sec.</br>\n"
+    "Free heap: " TPL("h") " bytes</br>\n"
+    TPL("t")
+#ifdef USE_SHT3X
+    TPL("s")
+#endif
+    "<p>\n"
+    TPL("n")
+    HTML_PAGE_END_STR;
+
+  webSendTemplate(request, PAGE, renderRoot);
 }
 
 static void webReset(AsyncWebServerRequest *request) {
@@ -427,7 +1010,7 @@ static void webOta(AsyncWebServerRequest *request, String filename, size_t index
   }
   if (final) {
     if (Update.end(true)) {
-      logger.printf_P(PSTR("Update success: %u B\n"), index + len);
+      logger.event_P(PSTR("Update success: %u B"), index + len);
     } else {
       Update.printError(logger);
     }
@@ -467,94 +1050,72 @@ static void webStoreConfig(AsyncWebServerRequest *request) {
   request->send(response);
 }
 
+static void renderWiFi(Print &out, char id, uint32_t data, uint32_t &cursor) {
+  switch (id) {
+    case 's':
+      printInput(out, PARAM_WIFI_SSID, config->wifi_ssid, sizeof(config->wifi_ssid));
+      break;
+    case 'p':
+      printInput(out, PARAM_WIFI_PSWD, config->wifi_pswd, sizeof(config->wifi_pswd));
+      break;
+    case 'n':
+      printInput(out, PARAM_ADM_NAME, config->adm_name, sizeof(config->adm_name));
+      break;
+    case 'a':
+      printInput(out, PARAM_ADM_PSWD, config->adm_pswd, sizeof(config->adm_pswd));
+      break;
+#ifdef USE_LLMNR
+    case 'l':
+      printInput(out, PARAM_LLMNR_NAME, config->llmnr_name, sizeof(config->llmnr_name));
+      break;
+#endif
+  }
+}
+
 static void webWiFi(AsyncWebServerRequest *request) {
   if (! webAuthorize(request))
     return;
 
   if (request->method() == HTTP_GET) {
-    AsyncResponseStream *response = request->beginResponseStream(FPSTR(TEXT_HTML));
-
-//    response->setCode(200);
-    response->print(FPSTR(HTML_PAGE_START));
-    response->print(F("WiFi Setup"));
-    response->print(FPSTR(HTML_PAGE_CONT));
-    response->print(FPSTR(HTML_STYLE_START));
-    response->print(F("body{background-color:#eee}\n"
-      "td:first-child{text-align:right}\n"));
-    response->print(FPSTR(HTML_STYLE_END));
-    response->print(FPSTR(HTML_BODY));
-    response->print(F("<h2>WiFi Setup</h2>\n"
+    static const char PAGE[] PROGMEM = HTML_PAGE_START_STR "WiFi Setup" HTML_PAGE_CONT_STR
+      HTML_STYLE_START_STR
+      "body{background-color:#eee}\n"
+      "td:first-child{text-align:right}\n"
+      HTML_STYLE_END_STR
+      HTML_BODY_STR
+      "<h2>WiFi Setup</h2>\n"
       "<form method='post'>\n"
       "<table>\n"
-      "<tr><td>WiFi SSID:</td><td><input type='text' name='"));
-    response->print(FPSTR(PARAM_WIFI_SSID));
-    response->print(F("' value='"));
-    encodeString(response, config->wifi_ssid);
-    response->print(F("' size="));
-    response->print(_min(TEXT_SIZE, sizeof(config->wifi_ssid) - 1));
-    response->print(F(" maxlength="));
-    response->print(sizeof(config->wifi_ssid) - 1);
-    response->print(F("></td></tr>\n"
-      "<tr><td>WiFi password:</td><td><input type='password' name='"));
-    response->print(FPSTR(PARAM_WIFI_PSWD));
-    response->print(F("' value='"));
-    encodeString(response, config->wifi_pswd);
-    response->print(F("' size="));
-    response->print(_min(TEXT_SIZE, sizeof(config->wifi_pswd) - 1));
-    response->print(F(" maxlength="));
-    response->print(sizeof(config->wifi_pswd) - 1);
-    response->print(F("></td></tr>\n"
+      "<tr><td>WiFi SSID:</td><td><input type='text' " TPL("s") "></td></tr>\n"
+      "<tr><td>WiFi password:</td><td><input type='password' " TPL("p") "></td></tr>\n"
       "<tr><td colspan=2>&nbsp;</td></tr>\n"
-      "<tr><td>Admin name:</td><td><input type='text' name='"));
-    response->print(FPSTR(PARAM_ADM_NAME));
-    response->print(F("' value='"));
-    encodeString(response, config->adm_name);
-    response->print(F("' size="));
-    response->print(_min(TEXT_SIZE, sizeof(config->adm_name) - 1));
-    response->print(F(" maxlength="));
-    response->print(sizeof(config->adm_name) - 1);
-    response->print(F("></td></tr>\n"
-      "<tr><td>Admin password:</td><td><input type='password' name='"));
-    response->print(FPSTR(PARAM_ADM_PSWD));
-    response->print(F("' value='"));
-    encodeString(response, config->adm_pswd);
-    response->print(F("' size="));
-    response->print(_min(TEXT_SIZE, sizeof(config->adm_pswd) - 1));
-    response->print(F(" maxlength="));
-    response->print(sizeof(config->adm_pswd) - 1);
-    response->print(F("></td></tr>\n"
+      "<tr><td>Admin name:</td><td><input type='text' " TPL("n") "></td></tr>\n"
+      "<tr><td>Admin password:</td><td><input type='password' " TPL("a") "></td></tr>\n"
 #ifdef USE_LLMNR
       "<tr><td colspan=2>&nbsp;</td></tr>\n"
-      "<tr><td>LLMNR host name:</td><td><input type='text' name='"));
-    response->print(FPSTR(PARAM_LLMNR_NAME));
-    response->print(F("' value='"));
-    encodeString(response, config->llmnr_name);
-    response->print(F("' size="));
-    response->print(_min(TEXT_SIZE, sizeof(config->llmnr_name) - 1));
-    response->print(F(" maxlength="));
-    response->print(sizeof(config->llmnr_name) - 1);
-    response->print(F("></td></tr>\n"
+      "<tr><td>LLMNR host name:</td><td><input type='text' " TPL("l") "></td></tr>\n"
 #endif
       "</table>\n"
       "<input type='submit' value='Save'>\n"
       "<input type='button' value='Back' onclick='location.href=\"/\"'>\n"
-      "</form>\n"));
-    response->print(FPSTR(HTML_PAGE_END));
-    request->send(response);
+      "</form>\n"
+      HTML_PAGE_END_STR;
+
+    webSendTemplate(request, PAGE, renderWiFi);
   } else if (request->method() == HTTP_POST) {
     AsyncWebParameter *param;
 
     if ((param = request->getParam(FPSTR(PARAM_WIFI_SSID), true)))
-      strlcpy(config->wifi_ssid, param->value().c_str(), sizeof(config->wifi_ssid));
+      config.set(&config_t::wifi_ssid, param->value().c_str());
     if ((param = request->getParam(FPSTR(PARAM_WIFI_PSWD), true)))
-      strlcpy(config->wifi_pswd, param->value().c_str(), sizeof(config->wifi_pswd));
+      config.set(&config_t::wifi_pswd, param->value().c_str());
     if ((param = request->getParam(FPSTR(PARAM_ADM_NAME), true)))
-      strlcpy(config->adm_name, param->value().c_str(), sizeof(config->adm_name));
+      config.set(&config_t::adm_name, param->value().c_str());
     if ((param = request->getParam(FPSTR(PARAM_ADM_PSWD), true)))
-      strlcpy(config->adm_pswd, param->value().c_str(), sizeof(config->adm_pswd));
+      config.set(&config_t::adm_pswd, param->value().c_str());
 #ifdef USE_LLMNR
     if ((param = request->getParam(FPSTR(PARAM_LLMNR_NAME), true)))
-      strlcpy(config->llmnr_name, param->value().c_str(), sizeof(config->llmnr_name));
+      config.set(&config_t::llmnr_name, param->value().c_str());
 #endif
     webStoreConfig(request);
   } else {
@@ -562,110 +1123,99 @@ static void webWiFi(AsyncWebServerRequest *request) {
   }
 }
 
+static void renderNtp(Print &out, char id, uint32_t data, uint32_t &cursor) {
+  switch (id) {
+    case 's':
+      printInput(out, PARAM_NTP_SERVER, config->ntp_server, sizeof(config->ntp_server));
+      break;
+    case 'z':
+      out.print(F("<select name='"));
+      out.print(FPSTR(PARAM_NTP_TZ));
+      out.print(F("'>"));
+      for (int8_t tz = -11; tz <= 13; ++tz) {
+        out.print(F("<option value='"));
+        out.print(tz);
+        out.print('\'');
+        if (config->ntp_tz == tz)
+          out.print(F(" selected"));
+        out.print(F(">GMT"));
+        if (tz >= 0)
+          out.print('+');
+        out.print(tz);
+        out.print(F("</option>"));
+      }
+      out.print(F("</select>"));
+      break;
+    case 'i':
+      printNumber(out, PARAM_NTP_INTERVAL, config->ntp_interval);
+      break;
+    case 'g':
+      printInput(out, PARAM_GREETINGS, config->greetings, sizeof(config->greetings));
+      break;
+    case 'm':
+      printNumber(out, PARAM_MORNING_HOUR, config->morning_hour);
+      break;
+    case 'M':
+      printNumber(out, PARAM_MORNING_BRIGHT, config->morning_bright);
+      break;
+    case 'e':
+      printNumber(out, PARAM_EVENING_HOUR, config->evening_hour);
+      break;
+    case 'E':
+      printNumber(out, PARAM_EVENING_BRIGHT, config->evening_bright);
+      break;
+  }
+}
+
 static void webNtp(AsyncWebServerRequest *request) {
   if (! webAuthorize(request))
     return;
 
   if (request->method() == HTTP_GET) {
-    AsyncResponseStream *response = request->beginResponseStream(FPSTR(TEXT_HTML));
-
-//    response->setCode(200);
-    response->print(FPSTR(HTML_PAGE_START));
-    response->print(F("NTP Setup"));
-    response->print(FPSTR(HTML_PAGE_CONT));
-    response->print(FPSTR(HTML_STYLE_START));
-    response->print(F("body{background-color:#eee}\n"
-      "td:first-child{text-align:right}\n"));
-    response->print(FPSTR(HTML_STYLE_END));
-    response->print(FPSTR(HTML_BODY));
-    response->print(F("<h2>NTP Setup</h2>\n"
+    static const char PAGE[] PROGMEM = HTML_PAGE_START_STR "NTP Setup" HTML_PAGE_CONT_STR
+      HTML_STYLE_START_STR
+      "body{background-color:#eee}\n"
+      "td:first-child{text-align:right}\n"
+      HTML_STYLE_END_STR
+      HTML_BODY_STR
+      "<h2>NTP Setup</h2>\n"
       "<form method='post'>\n"
       "<table>\n"
-      "<tr><td>NTP server:</td><td><input type='text' name='"));
-    response->print(FPSTR(PARAM_NTP_SERVER));
-    response->print(F("' value='"));
-    encodeString(response, config->ntp_server);
-    response->print(F("' size="));
-    response->print(_min(TEXT_SIZE, sizeof(config->ntp_server) - 1));
-    response->print(F(" maxlength="));
-    response->print(sizeof(config->ntp_server) - 1);
-    response->print(F("></td></tr>\n"
-      "<tr><td>Time zone:</td><td><select name='"));
-    response->print(FPSTR(PARAM_NTP_TZ));
-    response->print(F("'>"));
-    for (int8_t tz = -11; tz <= 13; ++tz) {
-      response->print(F("<option value='"));
-      response->print(tz);
-      response->print('\'');
-      if (config->ntp_tz == tz)
-        response->print(F(" selected"));
-      response->print(F(">GMT"));
-      if (tz >= 0)
-        response->print('+');
-      response->print(tz);
-      response->print(F("</option>"));
-    }
-    response->print(F("</select></td></tr>\n"
-      "<tr><td>Update interval (sec.):</td><td><input type='number' name='"));
-    response->print(FPSTR(PARAM_NTP_INTERVAL));
-    response->print(F("' value='"));
-    response->print(config->ntp_interval);
-    response->print(F("' min=0 max=65535></td></tr>\n"
+      "<tr><td>NTP server:</td><td><input type='text' " TPL("s") "></td></tr>\n"
+      "<tr><td>Time zone:</td><td>" TPL("z") "</td></tr>\n"
+      "<tr><td>Update interval (sec.):</td><td><input type='number' " TPL("i") " min=0 max=65535></td></tr>\n"
       "<tr><td colspan=2>&nbsp;</td></tr>\n"
-      "<tr><td>Greetings:</td><td><input type='text' name='"));
-    response->print(FPSTR(PARAM_GREETINGS));
-    response->print(F("' value='"));
-    encodeString(response, config->greetings);
-    response->print(F("' size="));
-    response->print(_min(TEXT_SIZE, sizeof(config->greetings) - 1));
-    response->print(F(" maxlength="));
-    response->print(sizeof(config->greetings) - 1);
-    response->print(F("></td></tr>\n"
-      "<tr><td>Morning hour:</td><td><input type='number' name='"));
-    response->print(FPSTR(PARAM_MORNING_HOUR));
-    response->print(F("' value='"));
-    response->print(config->morning_hour);
-    response->print(F("' min=0 max=23></td></tr>\n"
-      "<tr><td>Morning brightness:</td><td><input type='number' name='"));
-    response->print(FPSTR(PARAM_MORNING_BRIGHT));
-    response->print(F("' value='"));
-    response->print(config->morning_bright);
-    response->print(F("' min=0 max=15></td></tr>\n"
-      "<tr><td>Evening hour:</td><td><input type='number' name='"));
-    response->print(FPSTR(PARAM_EVENING_HOUR));
-    response->print(F("' value='"));
-    response->print(config->evening_hour);
-    response->print(F("' min=0 max=23></td></tr>\n"
-      "<tr><td>Evening brightness:</td><td><input type='number' name='"));
-    response->print(FPSTR(PARAM_EVENING_BRIGHT));
-    response->print(F("' value='"));
-    response->print(config->evening_bright);
-    response->print(F("' min=0 max=15></td></tr>\n"
+      "<tr><td>Greetings:</td><td><input type='text' " TPL("g") "></td></tr>\n"
+      "<tr><td>Morning hour:</td><td><input type='number' " TPL("m") " min=0 max=23></td></tr>\n"
+      "<tr><td>Morning brightness:</td><td><input type='number' " TPL("M") " min=0 max=15></td></tr>\n"
+      "<tr><td>Evening hour:</td><td><input type='number' " TPL("e") " min=0 max=23></td></tr>\n"
+      "<tr><td>Evening brightness:</td><td><input type='number' " TPL("E") " min=0 max=15></td></tr>\n"
       "</table>\n"
       "<input type='submit' value='Save'>\n"
       "<input type='button' value='Back' onclick='location.href=\"/\"'>\n"
-      "</form>\n"));
-    response->print(FPSTR(HTML_PAGE_END));
-    request->send(response);
+      "</form>\n"
+      HTML_PAGE_END_STR;
+
+    webSendTemplate(request, PAGE, renderNtp);
   } else if (request->method() == HTTP_POST) {
     AsyncWebParameter *param;
 
     if ((param = request->getParam(FPSTR(PARAM_NTP_SERVER), true)))
-      strlcpy(config->ntp_server, param->value().c_str(), sizeof(config->ntp_server));
+      config.set(&config_t::ntp_server, param->value().c_str());
     if ((param = request->getParam(FPSTR(PARAM_NTP_TZ), true)))
-      config->ntp_tz = constrain(param->value().toInt(), -11, 13);
+      config.set(&config_t::ntp_tz, constrain(param->value().toInt(), -11, 13));
     if ((param = request->getParam(FPSTR(PARAM_NTP_INTERVAL), true)))
-      config->ntp_interval = param->value().toInt();
+      config.set(&config_t::ntp_interval, param->value().toInt());
     if ((param = request->getParam(FPSTR(PARAM_GREETINGS), true)))
-      strlcpy(config->greetings, param->value().c_str(), sizeof(config->greetings));
+      config.set(&config_t::greetings, param->value().c_str());
     if ((param = request->getParam(FPSTR(PARAM_MORNING_HOUR), true)))
-      config->morning_hour = constrain(param->value().toInt(), 0, 23);
+      config.set(&config_t::morning_hour, constrain(param->value().toInt(), 0, 23));
     if ((param = request->getParam(FPSTR(PARAM_MORNING_BRIGHT), true)))
-      config->morning_bright = constrain(param->value().toInt(), 0, 15);
+      config.set(&config_t::morning_bright, constrain(param->value().toInt(), 0, 15));
     if ((param = request->getParam(FPSTR(PARAM_EVENING_HOUR), true)))
-      config->evening_hour = constrain(param->value().toInt(), 0, 23);
+      config.set(&config_t::evening_hour, constrain(param->value().toInt(), 0, 23));
     if ((param = request->getParam(FPSTR(PARAM_EVENING_BRIGHT), true)))
-      config->evening_bright = constrain(param->value().toInt(), 0, 15);
+      config.set(&config_t::evening_bright, constrain(param->value().toInt(), 0, 15));
     webStoreConfig(request);
     if (isEvening((ntpTime() / 3600) % 24))
       display.setBrightness(config->evening_bright);
@@ -676,6 +1226,25 @@ static void webNtp(AsyncWebServerRequest *request) {
   }
 }
 
+static void renderLog(Print &out, char id, uint32_t data, uint32_t &cursor) { // Log from cursor up to position when page was requested, the rest comes as events
+  if (id == 'l') { // Record per call, so only last one is formatted again when chunk is full
+    uint32_t next = logger.next(cursor);
+
+    if ((int32_t)(next - data) > 0)
+      next = data;
+    if ((int32_t)(next - cursor) <= 0) // End or log was cleared
+      return;
+    logger.forEach([&out](const char *str, uint16_t len) {
+      encodeString(&out, str, len);
+    }, cursor, next);
+    cursor = next;
+  } else if (id == 'e') {
+    out.print(FPSTR(URL_LOG_EVENTS));
+  } else if (id == 'p') {
+    out.print(data);
+  }
+}
+
 static void webLog(AsyncWebServerRequest *request) {
 /*
   if (! webAuthorize(request))
@@ -683,34 +1252,44 @@ static void webLog(AsyncWebServerRequest *request) {
 */
 
   if (request->method() == HTTP_GET) {
-    AsyncResponseStream *response = request->beginResponseStream(FPSTR(TEXT_HTML));
-
-//    response->setCode(200);
-    response->print(FPSTR(HTML_PAGE_START));
-    response->print(F("Log"));
-    response->print(FPSTR(HTML_PAGE_CONT));
-    response->print(FPSTR(HTML_STYLE_START));
-    response->print(F("body{background-color:#eee}\n"
-      "textarea{resize:none;overflow:auto;width:98%}\n"));
-    response->print(FPSTR(HTML_STYLE_END));
-    response->print(FPSTR(HTML_SCRIPT_START));
-    response->print(F("function logScroll(){\n"
+    static const char PAGE[] PROGMEM = HTML_PAGE_START_STR "Log" HTML_PAGE_CONT_STR
+      HTML_STYLE_START_STR
+      "body{background-color:#eee}\n"
+      "textarea{resize:none;overflow:auto;width:98%}\n"
+      HTML_STYLE_END_STR
+      HTML_SCRIPT_START_STR
+      "function logScroll(){\n"
       "let l=document.getElementById('log');\n"
       "l.scrollTop=l.scrollHeight;\n"
-      "}\n"));
-    response->print(FPSTR(HTML_SCRIPT_END));
-    response->print(FPSTR(HTML_BODY_START));
-    response->print(F(" onload='logScroll()'>\n"
+      "}\n"
+      "function logAppend(t){\n"
+      "let l=document.getElementById('log');\n"
+      "let b=l.scrollTop+l.clientHeight>=l.scrollHeight-4;\n"
+      "l.value+=t;\n"
+      "if(l.value.length>65536)l.value=l.value.slice(-32768);\n"
+      "if(b)l.scrollTop=l.scrollHeight;\n"
+      "}\n"
+      "function logStream(){\n"
+      "logScroll();\n"
+      "if(!window.EventSource)return;\n"
+      "let s=new EventSource('" TPL("e") "?since=" TPL("p") "');\n"
+      "s.addEventListener('log',e=>logAppend(e.data+'\\n'));\n"
+      "s.addEventListener('text',e=>logAppend(e.data));\n"
+      "s.addEventListener('dropped',e=>logAppend('['+e.data+' bytes of log dropped]\\n'));\n"
+      "}\n"
+      HTML_SCRIPT_END_STR
+      HTML_BODY_START_STR " onload='logStream()'>\n"
       "<h2>Log</h2>\n"
-      "<textarea id='log' rows=25 readonly>\n"));
-    encodeString(response, (const char*)logger);
-    response->print(F("</textarea>\n"
+      "<textarea id='log' rows=25 readonly>\n"
+      TPL("l")
+      "</textarea>\n"
       "<form method='post'>\n"
       "<input type='submit' value='Clear'>\n"
       "<input type='button' value='Back' onclick='location.href=\"/\"'>\n"
-      "</form>\n"));
-    response->print(FPSTR(HTML_PAGE_END));
-    request->send(response);
+      "</form>\n"
+      HTML_PAGE_END_STR;
+
+    webSendTemplate(request, PAGE, renderLog, logger.position(), logger.position() - logger.length()); // Log is rendered from its current start up to its current end
   } else if (request->method() == HTTP_POST) {
     AsyncResponseStream *response = request->beginResponseStream(FPSTR(TEXT_HTML));
 
@@ -729,12 +1308,313 @@ static void webLog(AsyncWebServerRequest *request) {
     response->print(FPSTR(HTML_PAGE_END));
     request->send(response);
     logger.clear();
-    logger.println(F("Log cleared"));
+    logger.event_P(PSTR("Log cleared"));
+  } else {
+    request->send(405);
+  }
+}
+
+static void webConfigBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) { // Collect upload without String
+  const size_t MAX_CONFIG_SIZE = 1024;
+
+  if ((! index) && (total <= MAX_CONFIG_SIZE))
+    request->_tempObject = malloc(total); // Freed by request
+  if (request->_tempObject && (index + len <= total))
+    memcpy((uint8_t*)request->_tempObject + index, data, len);
+}
+
+static void webConfig(AsyncWebServerRequest *request) { // Raw configuration (with version and CRC) for provisioning
+  if (! webAuthorize(request))
+    return;
+
+  if (request->method() == HTTP_GET) {
+    AsyncResponseStream *response = request->beginResponseStream(FPSTR(APP_BINARY));
+
+    response->addHeader(F("Content-Disposition"), F("attachment; filename=\"config.bin\""));
+    if (! config.exportTo(*response))
+      response->setCode(500);
+    request->send(response);
+  } else if (request->method() == HTTP_PUT) {
+    if (request->_tempObject && config.import((const uint8_t*)request->_tempObject, request->contentLength())) {
+      logger.event_P(PSTR("Configuration imported (version %u)"), config.storedVersion());
+      request->send(204);
+    } else {
+      request->send(400);
+    }
+  } else {
+    request->send(405);
+  }
+}
+
+static bool configField(uint8_t id, param_field_t *desc) { // Descriptor by persistent id
+  for (uint8_t i = 0; i < sizeof(CONFIG_FIELDS) / sizeof(CONFIG_FIELDS[0]); ++i) {
+    memcpy_P(desc, &CONFIG_FIELDS[i], sizeof(param_field_t));
+    if (desc->id == id)
+      return true;
+  }
+  return false;
+}
+
+static bool apiField(const char *name, api_field_t *field, param_field_t *desc) { // Exposed field by JSON name
+  for (uint8_t i = 0; i < sizeof(API_FIELDS) / sizeof(API_FIELDS[0]); ++i) {
+    memcpy_P(field, &API_FIELDS[i], sizeof(api_field_t));
+    if (! strcmp_P(name, field->name))
+      return configField(field->id, desc);
+  }
+  return false;
+}
+
+static bool apiConfigValue(void *arg, JsonParser::event_t event, uint8_t depth, const char *key, const char *value) { // Members of top level object into config copy
+  uint8_t *data = (uint8_t*)arg;
+  api_field_t field;
+  param_field_t desc;
+
+  if (! depth)
+    return (event == JsonParser::JSON_OBJECT) || (event == JsonParser::JSON_OBJECT_END);
+  if ((depth > 1) || (! key) || (! apiField(key, &field, &desc)))
+    return true; // Unknown members are ignored
+  if (desc.type == FIELD_STR) {
+    size_t len;
+
+    if ((event != JsonParser::JSON_STRING) || ((len = strlen(value)) >= desc.size)) // Not truncated
+      return false;
+    memcpy(&data[desc.offset], value, len);
+    memset(&data[desc.offset + len], 0, desc.size - len);
+  } else {
+    char *end;
+    int32_t v;
+
+    if (event != JsonParser::JSON_NUMBER)
+      return false;
+    v = strtol(value, &end, 10);
+    if (*end || (v < field.min) || (v > field.max))
+      return false;
+    memcpy(&data[desc.offset], &v, _min(desc.size, (uint16_t)sizeof(v))); // Little endian
+  }
+  return true;
+}
+
+struct api_config_t { // Configuration update, applied only when whole body is parsed and request is authorized
+  JsonParser parser;
+  config_t data;
+};
+
+static void webApiConfigBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) { // Parsed as it arrives, no copy of body
+  api_config_t *update;
+
+  if (! index) {
+    if ((update = (api_config_t*)malloc(sizeof(api_config_t)))) { // Freed by request
+      new (&update->parser) JsonParser(apiConfigValue, &update->data);
+      memcpy(&update->data, config.operator ->(), sizeof(config_t));
+    }
+    request->_tempObject = update;
+  }
+  if ((update = (api_config_t*)request->_tempObject))
+    update->parser.parse((const char*)data, len);
+}
+
+static void webApiConfig(AsyncWebServerRequest *request) { // Configuration as JSON object, members missing in update are kept
+  if (! webAuthorize(request))
+    return;
+
+  if (request->method() == HTTP_GET) {
+    AsyncResponseStream *response = request->beginResponseStream(FPSTR(TEXT_JSON));
+    const uint8_t *data = (const uint8_t*)config.operator ->();
+    JsonWriter json(*response);
+    api_field_t field;
+    param_field_t desc;
+
+    json.beginObject();
+    for (uint8_t i = 0; i < sizeof(API_FIELDS) / sizeof(API_FIELDS[0]); ++i) {
+      memcpy_P(&field, &API_FIELDS[i], sizeof(field));
+      if (field.secret || (! configField(field.id, &desc)))
+        continue;
+      json.key(field.name);
+      if (desc.type == FIELD_STR) {
+        json.value((const char*)&data[desc.offset]);
+      } else {
+        int32_t v = 0;
+
+        memcpy(&v, &data[desc.offset], _min(desc.size, (uint16_t)sizeof(v)));
+        if ((desc.type == FIELD_INT) && (desc.size < sizeof(v)) && (v & (1L << (desc.size * 8 - 1))))
+          v |= -1L << (desc.size * 8); // Sign extension
+        json.value(v);
+      }
+    }
+    json.endObject();
+    request->send(response);
+  } else if (request->method() == HTTP_PUT) {
+    api_config_t *update = (api_config_t*)request->_tempObject;
+
+    if ((! update) || (! update->parser.done())) {
+      request->send(400);
+      return;
+    }
+    config.set(update->data);
+    if (! config) {
+      if (! config.store()) {
+        logger.println(F("Error storing configuration!"));
+        request->send(500);
+        return;
+      }
+      logger.event_P(PSTR("Configuration updated"));
+    }
+    request->send(204);
+    if (isEvening((ntpTime() / 3600) % 24))
+      display.setBrightness(config->evening_bright);
+    else
+      display.setBrightness(config->morning_bright);
   } else {
     request->send(405);
   }
 }
 
+static void webApiStatus(AsyncWebServerRequest *request) { // Cheap to poll, a fraction of root page
+  AsyncResponseStream *response = request->beginResponseStream(FPSTR(TEXT_JSON), 128);
+  JsonWriter json(*response);
+  uint32_t now = ntpTime();
+
+  json.beginObject();
+  json.key(PSTR("uptime"));
+  json.value(millis() / 1000);
+  json.key(PSTR("heap"));
+  json.value(ESP.getFreeHeap());
+  json.key(PSTR("time"));
+  if (now)
+    json.value(now);
+  else
+    json.null();
+  json.key(PSTR("time_error")); // in ms.
+  if (now)
+    json.value(ntpError());
+  else
+    json.null();
+  json.key(PSTR("rssi"));
+  if (WiFi.getMode() == WIFI_STA)
+    json.value(WiFi.RSSI());
+  else
+    json.null();
+  json.key(PSTR("log_dropped")); // Not sent to log event clients
+  json.value(logDropped);
+  json.endObject();
+  request->send(response);
+}
+
+#ifdef USE_SHT3X
+static void jsonCenti(JsonWriter &json, int16_t value) { // Hundredths as number
+  if (value == SHT3x::INVALID)
+    json.null();
+  else
+    json.fixed(value, 2);
+}
+
+static void webApiSensor(AsyncWebServerRequest *request) {
+  static const char WINDOWS[3][7] PROGMEM = { "minute", "hour", "day" };
+
+  AsyncResponseStream *response = request->beginResponseStream(FPSTR(TEXT_JSON));
+  JsonWriter json(*response);
+
+  json.beginArray();
+  for (uint8_t i = 0; i < sht.count(); ++i) {
+    json.beginObject();
+    json.key(PSTR("address"));
+    json.value(sht[i].address());
+    json.key(PSTR("temp"));
+    jsonCenti(json, sensors[i].temp.value());
+    json.key(PSTR("hum"));
+    jsonCenti(json, sensors[i].hum.value());
+    json.key(PSTR("errors"));
+    json.value(sensors[i].errors);
+    for (uint8_t w = SensorFilter<>::WINDOW_MINUTE; w <= SensorFilter<>::WINDOW_DAY; ++w) { // "window":{"temp":[min,mean,max],"hum":[min,mean,max]}
+      json.key(WINDOWS[w]);
+      json.beginObject();
+      for (uint8_t h = 0; h < 2; ++h) {
+        const SensorFilter<> &filter = h ? sensors[i].hum : sensors[i].temp;
+
+        json.key(h ? PSTR("hum") : PSTR("temp"));
+        json.beginArray();
+        jsonCenti(json, filter.min((SensorFilter<>::window_t)w));
+        jsonCenti(json, filter.mean((SensorFilter<>::window_t)w));
+        jsonCenti(json, filter.max((SensorFilter<>::window_t)w));
+        json.endArray();
+      }
+      json.endObject();
+    }
+    json.endObject();
+  }
+  json.endArray();
+  request->send(response);
+}
+#endif
+
+#ifdef USE_SHT3X
+static void webHistory(AsyncWebServerRequest *request) { // ?tier=0..2&from=epoch&to=epoch&format=csv|json
+  History::tier_t tier = History::TIER_MINUTE;
+  uint32_t to = ntpTime();
+  uint32_t from;
+  HistoryReader::format_t format = HistoryReader::FORMAT_CSV;
+  std::shared_ptr<HistoryReader> reader;
+
+  if (request->hasParam(F("tier"))) {
+    long value = request->getParam(F("tier"))->value().toInt();
+
+    if ((value < 0) || (value >= History::TIER_COUNT)) { // Out of enum range before cast
+      request->send(400);
+      return;
+    }
+    tier = (History::tier_t)value;
+  }
+  if (request->hasParam(F("to")))
+    to = strtoul(request->getParam(F("to"))->value().c_str(), nullptr, 10);
+  if (! to)
+    to = 0xFFFFFFFF;
+  from = to - 86400; // Last day by default
+  if (request->hasParam(F("from")))
+    from = strtoul(request->getParam(F("from"))->value().c_str(), nullptr, 10);
+  if (request->hasParam(F("format")) && request->getParam(F("format"))->value().equals(F("json")))
+    format = HistoryReader::FORMAT_JSON;
+  reader = std::make_shared<HistoryReader>(history, tier, from, to, format); // Freed with response
+  request->send(request->beginChunkedResponse(FPSTR(format == HistoryReader::FORMAT_JSON ? TEXT_JSON : TEXT_CSV),
+    [reader](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+      return reader->read(buffer, maxLen);
+    }));
+}
+#endif
+
+#ifdef USE_STATS
+static void webStats(AsyncWebServerRequest *request) {
+  const uint8_t MAX_STATS = MAX_ACTIONS + 2; // With render and scroll
+
+  const TaskStats *stats[MAX_STATS];
+  const char *names[MAX_STATS];
+  uint8_t count = 0;
+
+  stats[count] = &renderStats;
+  names[count++] = PSTR("render");
+  stats[count] = &scrollStats;
+  names[count++] = PSTR("scroll");
+  for (uint8_t i = 0; (i < actions.capacity()) && (count < MAX_STATS); ++i) {
+    decltype(actions)::handle_t handle = actions.handle(i);
+
+    if (handle) {
+      stats[count] = &actions.stats(handle);
+      names[count++] = actions.name(handle);
+    }
+  }
+  if (request->hasParam(F("format")) && request->getParam(F("format"))->value().equals(F("prometheus"))) {
+    AsyncResponseStream *response = request->beginResponseStream(FPSTR(TEXT_PLAIN));
+
+    TaskStats::printPrometheus(*response, stats, names, count);
+    request->send(response);
+  } else {
+    AsyncResponseStream *response = request->beginResponseStream(FPSTR(TEXT_JSON));
+
+    TaskStats::printJson(*response, stats, names, count);
+    request->send(response);
+  }
+}
+#endif
+
 static bool captivePortal(uint32_t timeout = 0) {
   DNSServer dns;
   char ssid[sizeof(CP_SSID) + 6];
@@ -795,10 +1675,93 @@ static bool captivePortal(uint32_t timeout = 0) {
   return true;
 }
 
+static uint32_t clockUpdating() {
+  static const char WEEKDAYS[7][3] PROGMEM = {
+    "\xCF\xED", "\xC2\xF2", "\xD1\xF0", "\xD7\xF2", "\xCF\xF2", "\xD1\xE1", "\xC2\xF1" // "Пн", "Вт", "Ср", "Чт", "Пт", "Сб", "Вс"
+  };
+
+  static Task task;
+  uint32_t t;
+  uint16_t y;
+  uint8_t h, m, s, w, d, mo;
+  char str[15];
+#ifdef USE_SHT3X
+  int8_t sensor;
+#endif
+#ifdef USE_STATS
+  uint32_t start;
+#endif
+
+  TASK_BEGIN(task);
+  while (true) {
+    if (! (t = ntpTime())) {
+      TASK_DELAY(task, 100);
+      continue;
+    }
+    parseEpoch(t, &h, &m, &s, &w, &d, &mo, &y);
+
+    if (s < 50) {
+      if ((s <= 1) && (m == 0)) { // Beginning of hour
+        if (h == config->morning_hour)
+          display.setBrightness(config->morning_bright);
+        else if (h == config->evening_hour)
+          display.setBrightness(config->evening_bright);
+      }
+#ifdef USE_SHT3X
+      if ((sensor = sensorShown(s)) >= 0) {
+#ifdef USE_STATS
+        start = TaskStats::start();
+#endif
+        sensorToStr(str, sensor, PSTR("\xB0"));
+        display.scroll(str);
+#ifdef USE_STATS
+        scrollStats.stop(start);
+#endif
+        TASK_AWAIT_UNTIL(task, millis() + (10 - s % 10) * 1000 - ntpFraction());
+        display.noScroll();
+      } else {
+#endif
+#ifdef USE_STATS
+        start = TaskStats::start();
+#endif
+        sprintf_P(str, PSTR("%02u:%02u"), h, m);
+        t = (display.width() - display.strWidth(str)) / 2;
+        display.beginUpdate();
+        display.clear();
+        display.printStr(t, 0, str);
+        if (s & 0x01) {
+          str[2] = '\0';
+          display.drawPattern(t + display.strWidth(str) + display.FONT_GAP, 0, display.charWidth(':'), display.FONT_HEIGHT, (uint8_t)0);
+        }
+        display.endUpdate();
+#ifdef USE_STATS
+        renderStats.stop(start);
+#endif
+        TASK_AWAIT_UNTIL(task, millis() + 1000 - ntpFraction());
+#ifdef USE_SHT3X
+      }
+#endif
+    } else {
+#ifdef USE_STATS
+      start = TaskStats::start();
+#endif
+      strcpy_P(str, WEEKDAYS[w]);
+      sprintf_P(&str[strlen(str)], PSTR(" %02u.%02u.%u"), d, mo, y);
+      display.scroll(str);
+#ifdef USE_STATS
+      scrollStats.stop(start);
+#endif
+      TASK_AWAIT_UNTIL(task, millis() + (60 - s) * 1000 - ntpFraction());
+      display.noScroll();
+    }
+  }
+  TASK_END(task);
+}
+
 static uint32_t getRstCount() {
   uint32_t rst_count[2];
 
-  ESP.rtcUserMemoryRead(0, rst_count, sizeof(rst_count));
+  ESP.rtcUserMemoryRead(RTC_RST_OFFSET, rst_count, sizeof(rst_count));
   if (~rst_count[0] == rst_count[1])
     return rst_count[1];
   return 0;
@@ -807,13 +1770,13 @@ static uint32_t getRstCount() {
 static uint32_t addRstCount() {
   uint32_t rst_count[2];
 
-  ESP.rtcUserMemoryRead(0, rst_count, sizeof(rst_count));
+  ESP.rtcUserMemoryRead(RTC_RST_OFFSET, rst_count, sizeof(rst_count));
   if (~rst_count[0] == rst_count[1])
     ++rst_count[1];
   else
     rst_count[1] = 1;
   rst_count[0] = ~rst_count[1];
-  ESP.rtcUserMemoryWrite(0, rst_count, sizeof(rst_count));
+  ESP.rtcUserMemoryWrite(RTC_RST_OFFSET, rst_count, sizeof(rst_count));
   return rst_count[1];
 }
 
@@ -822,12 +1785,14 @@ static void clearRstCount() {
 
   rst_count[1] = 0;
   rst_count[0] = ~rst_count[1];
-  ESP.rtcUserMemoryWrite(0, rst_count, sizeof(rst_count));
+  ESP.rtcUserMemoryWrite(RTC_RST_OFFSET, rst_count, sizeof(rst_count));
 }
 
 void setup() {
   if (ESP.getResetInfoPtr()->reason == REASON_EXT_SYS_RST)
     addRstCount();
+  if (ESP.getResetInfoPtr()->reason != REASON_DEFAULT_RST) // Warm reset
+    ntpRestore(RTC_NTP_OFFSET, RTC_NTP_PERIOD);
 
 #ifdef USE_SERIAL
   Serial.begin(115200);
@@ -840,6 +1805,14 @@ void setup() {
 
   if (! logger.begin())
     restart(F("Not enoung memory!"));
+  if (ESP.getResetInfoPtr()->reason != REASON_DEFAULT_RST) { // Warm reset
+    if (logger.rtcRestore(RTC_LOG_OFFSET, RTC_LOG_SIZE)) {
+      logArchived = logger.position(); // Tail was archived by halt()/restart(), not appended to log file again
+      logger.printf_P(PSTR("--- Restarted (%s) ---\n"), ESP.getResetReason().c_str());
+    }
+  }
+  if (ntpTime())
+    logger.event_P(PSTR("Last known time restored (+/-%u ms)"), ntpError());
 
   if (! LittleFS.begin()) {
     if ((! LittleFS.format()) || (! LittleFS.begin()))
@@ -880,15 +1853,17 @@ void setup() {
 //    cfg->evening_bright = 0;
   });
   config.begin();
+  if (config.migrated())
+    logger.event_P(PSTR("Configuration migrated from version %u (%u us)"), config.storedVersion(), config.loadTime());
 
 #ifdef USE_SHT3X
-  sht = new SHT3x<>();
-  sht->init();
-  if (! sht->begin()) {
-    delete sht;
-    sht = nullptr;
+  SHT3x::init();
+  if (sht.scan())
+    logger.event_P(PSTR("%u SHT3x sensor(s) found"), sht.count());
+  else
     logger.println(F("SHT3x not found!"));
-  }
+  if (history.restore())
+    logger.println(F("Unsaved history restored"));
 #endif
 
   display.init();
@@ -948,7 +1923,19 @@ void setup() {
   http.on(URL_WIFI, HTTP_ANY, webWiFi);
   http.on(URL_NTP, HTTP_ANY, webNtp);
   http.on(URL_LOG, HTTP_ANY, webLog);
-  http.serveStatic(URL_ROOT, LittleFS, URL_ROOT);
+  logEvents.setFilter(logEventsFilter);
+  logEvents.onConnect(logEventsConnect);
+  http.addHandler(&logEvents);
+  http.on(URL_CONFIG, HTTP_GET | HTTP_PUT, webConfig, nullptr, webConfigBody);
+  http.on(URL_API_STATUS, HTTP_GET, webApiStatus);
+  http.on(URL_API_CONFIG, HTTP_GET | HTTP_PUT, webApiConfig, nullptr, webApiConfigBody);
+#ifdef USE_SHT3X
+  http.on(URL_HISTORY, HTTP_GET, webHistory);
+  http.on(URL_API_SENSOR, HTTP_GET, webApiSensor);
+#endif
+#ifdef USE_STATS
+  http.on(URL_STATS, HTTP_GET, webStats);
+#endif
 
   if (getRstCount() >= RST_RESET) {
     config.clear();
@@ -975,10 +1962,20 @@ void setup() {
   clearRstCount();
 
   if (*config->ntp_server)
-    actions.add(ntpUpdating);
+    actions.add(ntpUpdating, 0, PSTR("ntp"));
+  actions.add(ntpSaving, 0, PSTR("ntp_save"));
+  actions.add(logSaving, LOG_SAVE_PERIOD, PSTR("log_save"));
+#ifdef USE_SERIAL
+  logFlusher = actions.add(logFlushing, 0, PSTR("log"));
+  logger.onQueued(logQueued);
+#endif
+  actions.add(logStreaming, LOG_EVENT_PERIOD, PSTR("log_events"));
+  actions.add(clockUpdating, 0, PSTR("clock"));
 #ifdef USE_SHT3X
-  if (sht)
-    actions.add(shtUpdating);
+  if (sht.count()) {
+    actions.add(shtUpdating, 0, PSTR("sht3x"));
+    actions.add(historySaving, HISTORY_SAVE_PERIOD, PSTR("hist_save"));
+  }
 #endif
 
 #ifdef USE_LLMNR
@@ -992,62 +1989,17 @@ void setup() {
 }
 
 void loop() {
-  uint32_t t;
+  const uint32_t MAX_SLEEP = 100; // Upper bound of restart request latency
 
   if (restarting) {
     delay(100);
     restart(F("Restarting"));
   }
-  if ((t = ntpTime())) {
-    uint16_t y;
-    uint8_t h, m, s, w, d, mo;
-
-    parseEpoch(t, &h, &m, &s, &w, &d, &mo, &y);
-
-    if (s < 50) {
-      char str[12];
-
-      if ((s <= 1) && (m == 0)) { // Beginning of hour
-        if (h == config->morning_hour)
-          display.setBrightness(config->morning_bright);
-        else if (h == config->evening_hour)
-          display.setBrightness(config->evening_bright);
-      }
-#ifdef USE_SHT3X
-      if (sht && (! isnan(temp)) && (! isnan(hum)) && (((s >= 10) && (s < 20)) || ((s >= 30) && (s < 40)))) {
-        sprintf_P(str, PSTR("%0.1f\xB0 %0.1f%%"), temp, hum);
-        display.scroll(str);
-        delay((10 - s % 10) * 1000);
-        display.noScroll();
-      } else {
-#endif
-        sprintf_P(str, PSTR("%02u:%02u"), h, m);
-        t = (display.width() - display.strWidth(str)) / 2;
-        display.beginUpdate();
-        display.clear();
-        display.printStr(t, 0, str);
-        if (s & 0x01) {
-          str[2] = '\0';
-          display.drawPattern(t + display.strWidth(str) + display.FONT_GAP, 0, display.charWidth(':'), display.FONT_HEIGHT, (uint8_t)0);
-        }
-        display.endUpdate();
-        delay(1000);
-#ifdef USE_SHT3X
-      }
-#endif
-    } else {
-      static const char WEEKDAYS[7][3] PROGMEM = {
-        "\xCF\xED", "\xC2\xF2", "\xD1\xF0", "\xD7\xF2", "\xCF\xF2", "\xD1\xE1", "\xC2\xF1" // "Пн", "Вт", "Ср", "Чт", "Пт", "Сб", "Вс"
-      };
+  config.loop();
+  actions.loop();
 
-      char str[15];
+  int32_t wait = actions.nextDeadline() - millis();
 
-      strcpy_P(str, WEEKDAYS[w]);
-      sprintf_P(&str[strlen(str)], PSTR(" %02u.%02u.%u"), d, mo, y);
-      display.scroll(str);
-      delay((60 - t % 60) * 1000);
-      display.noScroll();
-    }
-  }
-  actions.loop();
+  if (wait > 0)
+    delay(_min((uint32_t)wait, MAX_SLEEP));
 }